@@ -21,8 +21,41 @@
 #include <znc/Server.h>
 #include <znc/User.h>
 #include <znc/Chan.h>
+#include <znc/Query.h>
+#include <znc/Socket.h>
+#include <znc/WebModules.h>
+#include <znc/FileUtils.h>
+#include <znc/ZNCDebug.h>
 #include <znc/znc.h>
+#include "admintable.h"
+#ifdef HAVE_LIBSSL
+#include <openssl/dh.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#endif
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <climits>
+#include <initializer_list>
+#include <strings.h>
+#include <unordered_map>
+#include <deque>
 #include <functional>
+#include <algorithm>
+#include <memory>
 
 #if (VERSION_MAJOR < 1) || (VERSION_MAJOR == 1 && VERSION_MINOR < 7)
 #error The admin module requires ZNC version 1.7.0 or later.
@@ -55,240 +88,1226 @@ struct Command
 	std::function<void(T*, const CString&)> exec;
 };
 
-class CAdminMod : public CModule
+// visits a config value: scope ("", "user", "user/network" or
+// "user/network/#chan"), variable name and the value as returned
+// by the getter (list values are separated by newlines)
+typedef std::function<void(const CString&, const CString&, const CString&)> ConfigVisitor;
+
+// estimates of the heap memory owned by a value, not counting the value
+// itself; tree and hash nodes are assumed to carry a few pointers each
+static const size_t NodeOverhead = 4 * sizeof(void*);
+
+template <typename T>
+static size_t EstimateSize(const T&) { return 0; }
+static size_t EstimateSize(const CString& sStr);
+static size_t EstimateSize(const MCString& msStr);
+template <typename A, typename B>
+static size_t EstimateSize(const std::pair<A, B>& Pair);
+template <typename T>
+static size_t EstimateSize(const std::vector<T>& vItems);
+template <typename T>
+static size_t EstimateSize(const std::deque<T>& dItems);
+template <typename T>
+static size_t EstimateSize(const std::set<T>& sItems);
+template <typename K, typename V>
+static size_t EstimateSize(const std::map<K, V>& mItems);
+template <typename K, typename V, typename H>
+static size_t EstimateSize(const std::unordered_map<K, V, H>& mItems);
+template <typename T>
+static size_t EstimateSize(const Variable<T>& Var);
+template <typename T>
+static size_t EstimateSize(const Command<T>& Cmd);
+
+static size_t EstimateSize(const CString& sStr)
+{
+	// short strings live in the object itself
+	return sStr.capacity() > 15 ? sStr.capacity() + 1 : 0;
+}
+
+static size_t EstimateSize(const MCString& msStr)
+{
+	return EstimateSize(static_cast<const std::map<CString, CString>&>(msStr));
+}
+
+template <typename A, typename B>
+static size_t EstimateSize(const std::pair<A, B>& Pair)
+{
+	return EstimateSize(Pair.first) + EstimateSize(Pair.second);
+}
+
+template <typename T>
+static size_t EstimateSize(const std::vector<T>& vItems)
+{
+	size_t uSize = vItems.capacity() * sizeof(T);
+	for (const T& Item : vItems)
+		uSize += EstimateSize(Item);
+	return uSize;
+}
+
+template <typename T>
+static size_t EstimateSize(const std::deque<T>& dItems)
+{
+	size_t uSize = dItems.size() * sizeof(T);
+	for (const T& Item : dItems)
+		uSize += EstimateSize(Item);
+	return uSize;
+}
+
+template <typename T>
+static size_t EstimateSize(const std::set<T>& sItems)
+{
+	size_t uSize = sItems.size() * (sizeof(T) + NodeOverhead);
+	for (const T& Item : sItems)
+		uSize += EstimateSize(Item);
+	return uSize;
+}
+
+template <typename K, typename V>
+static size_t EstimateSize(const std::map<K, V>& mItems)
+{
+	size_t uSize = mItems.size() * (sizeof(std::pair<const K, V>) + NodeOverhead);
+	for (const auto& it : mItems)
+		uSize += EstimateSize(it.first) + EstimateSize(it.second);
+	return uSize;
+}
+
+template <typename K, typename V, typename H>
+static size_t EstimateSize(const std::unordered_map<K, V, H>& mItems)
+{
+	size_t uSize = mItems.bucket_count() * sizeof(void*) + mItems.size() * (sizeof(std::pair<const K, V>) + 2 * sizeof(void*));
+	for (const auto& it : mItems)
+		uSize += EstimateSize(it.first) + EstimateSize(it.second);
+	return uSize;
+}
+
+template <typename T>
+static size_t EstimateSize(const Variable<T>& Var)
+{
+	return EstimateSize(Var.name) + EstimateSize(Var.description);
+}
+
+template <typename T>
+static size_t EstimateSize(const Command<T>& Cmd)
+{
+	return EstimateSize(Cmd.syntax) + EstimateSize(Cmd.description);
+}
+
+class CStringPool
 {
 public:
-	MODCONSTRUCTOR(CAdminMod)
+	unsigned int Intern(const CString& sStr)
 	{
+		auto it = m_mIndex.find(sStr);
+		if (it == m_mIndex.end()) {
+			it = m_mIndex.insert(std::make_pair(sStr, (unsigned int) m_vStrings.size())).first;
+			m_vStrings.push_back(&it->first);
+		}
+		return it->second;
 	}
 
-	void OnModCommand(const CString& sLine) override;
-	EModRet OnUserRaw(CString& sLine) override;
+	const CString& Get(unsigned int uIdx) const { return *m_vStrings[uIdx]; }
+	size_t Size() const { return m_vStrings.size(); }
+	size_t Memory() const { return EstimateSize(m_mIndex) + EstimateSize(m_vStrings); }
 
-	CString GetInfix() const;
-	void SetInfix(const CString& sInfix);
+private:
+	// the keys of an unordered map are stable across rehashing
+	std::unordered_map<CString, unsigned int, std::hash<std::string>> m_mIndex;
+	std::vector<const CString*> m_vStrings;
+};
+
+struct ConfigRecord
+{
+	unsigned int scope;
+	unsigned int var;
+	unsigned int value;
+};
+
+struct ConfigSnapshot
+{
+	time_t created;
+	std::vector<ConfigRecord> records;
+};
+
+typedef TAdminTable<CString> CAdminTable;
+
+// the arena capacity in bytes kept between commands
+static const size_t TableArenaKeep = 64 * 1024;
+
+// runs a job every interval until the job returns false
+class CAdminTimer : public CTimer
+{
+public:
+	CAdminTimer(CModule* pModule, unsigned int uInterval, const CString& sLabel, const std::function<bool()>& fnJob)
+		: CTimer(pModule, uInterval, 0, sLabel, ""), m_fnJob(fnJob)
+	{
+	}
 
 protected:
-	EModRet OnUserCommand(CUser* pUser, const CString& sLine);
-	EModRet OnNetworkCommand(CIRCNetwork* pNetwork, const CString& sLine);
-	EModRet OnChanCommand(CChan* pChan, const CString& sLine);
+	void RunJob() override
+	{
+		if (!m_fnJob())
+			Stop();
+	}
 
 private:
-	template <typename C>
-	void OnHelpCommand(const CString& sLine, const std::vector<C>& vCmds);
-	template <typename T, typename V>
-	void OnListCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars);
-	template <typename T, typename V>
-	void OnGetCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars);
-	template <typename T, typename V>
-	void OnSetCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars);
-	template <typename T, typename V>
-	void OnResetCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars);
-	template <typename T, typename C>
-	void OnExecCommand(T* pObject, const CString& sLine, const std::vector<C>& vCmds);
+	std::function<bool()> m_fnJob;
+};
 
-	template <typename T>
-	void OnListModsCommand(T* pObject, const CString& sArgs, CModInfo::EModuleType eType);
-	template <typename T>
-	void OnLoadModCommand(T* pObject, const CString& sArgs, CModInfo::EModuleType eType);
-	template <typename T>
-	void OnReloadModCommand(T* pObject, const CString& sArgs);
-	template <typename T>
-	void OnUnloadModCommand(T* pObject, const CString& sArgs);
+#ifdef HAVE_PTHREAD
+// runs work in a separate thread and finishes it in the main loop
+class CAdminJob : public CModuleJob
+{
+public:
+	CAdminJob(CModule* pModule, const CString& sName, const std::function<void()>& fnThread, const std::function<void()>& fnMain)
+		: CModuleJob(pModule, sName, ""), m_fnThread(fnThread), m_fnMain(fnMain)
+	{
+	}
 
-	template <typename C>
-	CTable FilterCmdTable(const std::vector<C>& vCmds, const CString& sFilter) const;
-	template <typename V>
-	CTable FilterVarTable(const std::vector<V>& vVars, const CString& sFilter) const;
+	void runThread() override { m_fnThread(); }
+	void runMain() override { m_fnMain(); }
 
-	void PutSuccess(const CString& sLine, const CString& sTarget = "");
-	void PutUsage(const CString& sSyntax, const CString& sTarget = "");
-	void PutError(const CString& sLine, const CString& sTarget = "");
-	void PutLine(const CString& sLine, const CString& sTarget = "");
-	void PutTable(const CTable& Table, const CString& sTarget = "");
+private:
+	std::function<void()> m_fnThread;
+	std::function<void()> m_fnMain;
+};
+#endif
 
-	CString m_sTarget;
+// accepts connections on a Unix domain socket and runs each line
+// through a handler, writing back what the handler returns
+class CAdminControl : public CSMonitorFD
+{
+public:
+	CAdminControl(int iListenFD, const std::function<CString(const CString&)>& fnLine)
+		: m_iListenFD(iListenFD), m_fnLine(fnLine)
+	{
+		Add(m_iListenFD, CSockManager::ECT_Read);
+	}
+	~CAdminControl() override { Close(); }
 
+	void Close()
+	{
+		for (const auto& it : m_mConnections)
+			close(it.first);
+		m_mConnections.clear();
+		if (m_iListenFD >= 0)
+			close(m_iListenFD);
+		m_iListenFD = -1;
+		m_miiMonitorFDs.clear();
+		DisableMonitor();
+	}
 
-	// TODO: expose the default constants needed by the reset methods?
+	size_t GetPendingBytes() const
+	{
+		size_t uBytes = 0;
+		for (const auto& it : m_mConnections)
+			uBytes += it.second.in.capacity() + it.second.out.capacity();
+		return uBytes;
+	}
 
-	const std::vector<Variable<CZNC>> GlobalVars = {
-		{
-			"AnonIPLimit", IntType,
-			"The limit of anonymous unidentified connections per IP.",
-			[=](const CZNC* pZNC) {
-				return CString(pZNC->GetAnonIPLimit());
-			},
-			[=](CZNC* pZNC, const CString& sVal) {
-				pZNC->SetAnonIPLimit(sVal.ToUInt());
-				return true;
-			},
-			[=](CZNC* pZNC) {
-				pZNC->SetAnonIPLimit(10);
-				return true;
-			}
-		},
-		// TODO: BindHost
-		{
-			"ConnectDelay", IntType,
-			"The number of seconds every IRC connection is delayed.",
-			[=](const CZNC* pZNC) {
-				return CString(pZNC->GetConnectDelay());
-			},
-			[=](CZNC* pZNC, const CString& sVal) {
-				pZNC->SetConnectDelay(sVal.ToUInt());
-				return true;
-			},
-			[=](CZNC* pZNC) {
-				pZNC->SetConnectDelay(5);
-				return true;
+	bool FDsThatTriggered(const std::map<cs_sock_t, short>& miiReadyFds) override
+	{
+		for (const auto& it : miiReadyFds) {
+			if (it.first == m_iListenFD) {
+				Accept();
+			} else if (m_mConnections.count(it.first)) {
+				// answers to the last lines go out before a closed connection is dropped
+				const bool bOpen = !(it.second & CSockManager::ECT_Read) || Read(it.first);
+				if (!Flush(it.first) || !bOpen)
+					Drop(it.first);
 			}
-		},
-		{
-			"HideVersion", BoolType,
-			"Whether the version number is hidden from the web interface and CTCP VERSION replies.",
-			[=](const CZNC* pZNC) {
-				return CString(pZNC->GetHideVersion());
-			},
-			[=](CZNC* pZNC, const CString& sVal) {
-				pZNC->SetHideVersion(sVal.ToBool());
-				return true;
-			},
-			[=](CZNC* pZNC) {
-				pZNC->SetHideVersion(false);
-				return true;
+		}
+		return IsEnabled();
+	}
+
+private:
+	struct Connection
+	{
+		CString in;
+		CString out;
+	};
+
+	void Accept()
+	{
+		int iFD;
+		while ((iFD = accept(m_iListenFD, nullptr, nullptr)) >= 0) {
+			fcntl(iFD, F_SETFL, fcntl(iFD, F_GETFL) | O_NONBLOCK);
+			fcntl(iFD, F_SETFD, FD_CLOEXEC);
+			m_mConnections[iFD];
+			Add(iFD, CSockManager::ECT_Read);
+		}
+	}
+
+	bool Read(int iFD)
+	{
+		Connection& Conn = m_mConnections[iFD];
+		char szBuf[64 * 1024];
+		ssize_t iLen;
+		while ((iLen = read(iFD, szBuf, sizeof(szBuf))) > 0)
+			Conn.in.append(szBuf, iLen);
+		if (iLen < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			return false;
+
+		// all complete lines of a read are answered with a single write
+		size_t uStart = 0, uEnd;
+		while ((uEnd = Conn.in.find('\n', uStart)) != CString::npos) {
+			const CString sLine = Conn.in.substr(uStart, uEnd - uStart).TrimRight_n("\r");
+			uStart = uEnd + 1;
+			if (sLine.empty())
+				continue;
+			const CString sReply = m_fnLine(sLine);
+			// the handler may have closed the socket
+			if (!IsEnabled())
+				return false;
+			Conn.out += sReply;
+		}
+		Conn.in.erase(0, uStart);
+		return iLen < 0 && Conn.in.size() <= 1024 * 1024;
+	}
+
+	bool Flush(int iFD)
+	{
+		auto it = m_mConnections.find(iFD);
+		if (it == m_mConnections.end())
+			return true;
+		Connection& Conn = it->second;
+		while (!Conn.out.empty()) {
+			const ssize_t iLen = write(iFD, Conn.out.data(), Conn.out.size());
+			if (iLen < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+					return false;
+				break;
 			}
-		},
-		{
-			"MaxBufferSize", IntType,
-			"The maximum playback buffer size. Only admin users can exceed the limit.",
-			[=](const CZNC* pZNC) {
-				return CString(pZNC->GetMaxBufferSize());
-			},
-			[=](CZNC* pZNC, const CString& sVal) {
-				pZNC->SetMaxBufferSize(sVal.ToUInt());
-				return true;
-			},
-			[=](CZNC* pZNC) {
-				pZNC->SetMaxBufferSize(500);
-				return true;
+			Conn.out.erase(0, iLen);
+		}
+		Add(iFD, Conn.out.empty() ? CSockManager::ECT_Read : CSockManager::ECT_Read | CSockManager::ECT_Write);
+		return true;
+	}
+
+	void Drop(int iFD)
+	{
+		if (m_mConnections.erase(iFD)) {
+			Remove(iFD);
+			close(iFD);
+		}
+	}
+
+	int m_iListenFD;
+	std::map<int, Connection> m_mConnections;
+	std::function<CString(const CString&)> m_fnLine;
+};
+
+// the output of a command run through the control socket
+struct ControlCapture
+{
+	VCString lines;
+	bool error = false;
+};
+
+static CString EscapeJSON(const CString& sStr)
+{
+	CString sOut;
+	sOut.reserve(sStr.size() + 2);
+	for (unsigned char c : sStr) {
+		switch (c) {
+		case '"': sOut += "\\\""; break;
+		case '\\': sOut += "\\\\"; break;
+		case '\n': sOut += "\\n"; break;
+		case '\r': sOut += "\\r"; break;
+		case '\t': sOut += "\\t"; break;
+		default:
+			if (c < 0x20) {
+				char szEsc[8];
+				snprintf(szEsc, sizeof(szEsc), "\\u%04x", c);
+				sOut += szEsc;
+			} else {
+				sOut += c;
 			}
-		},
-		{
-			"Motd", ListType,
-			"The list of 'message of the day' lines that are sent to clients on connect via notice from *status.",
-			[=](const CZNC* pZNC) {
-				const VCString& vsMotd = pZNC->GetMotd();
-				return CString("\n").Join(vsMotd.begin(), vsMotd.end());
-			},
-			[=](CZNC* pZNC, const CString& sVal) {
-				pZNC->AddMotd(sVal);
-				return true;
-			},
-			[=](CZNC* pZNC) {
-				pZNC->ClearMotd();
-				return true;
-			},
-		},
-		// TODO: PidFile
-		{
-			"ProtectWebSessions", BoolType,
-			"Whether IP changing during each web session is disallowed.",
-			[=](const CZNC* pZNC) {
-				return CString(pZNC->GetProtectWebSessions());
-			},
-			[=](CZNC* pZNC, const CString& sVal) {
-				pZNC->SetProtectWebSessions(sVal.ToBool());
-				return true;
-			},
-			[=](CZNC* pZNC) {
-				pZNC->SetProtectWebSessions(true);
-				return true;
+		}
+	}
+	return sOut;
+}
+
+// the upper bounds (seconds) of the command latency histogram buckets
+static const double LatencyBounds[] = { 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1 };
+static const size_t LatencyBuckets = sizeof(LatencyBounds) / sizeof(LatencyBounds[0]);
+
+struct LatencyHistogram
+{
+	unsigned long long buckets[LatencyBuckets] = {}; // non-cumulative
+	unsigned long long count = 0;
+	double sum = 0;
+
+	void Observe(double dSeconds)
+	{
+		for (size_t i = 0; i < LatencyBuckets; ++i) {
+			if (dSeconds <= LatencyBounds[i]) {
+				++buckets[i];
+				break;
 			}
-		},
-		{
-			"ServerThrottle", IntType,
-			"The number of seconds between connect attempts to the same hostname.",
-			[=](const CZNC* pZNC) {
-				return CString(pZNC->GetServerThrottle());
-			},
-			[=](CZNC* pZNC, const CString& sVal) {
-				pZNC->SetServerThrottle(sVal.ToUInt());
-				return true;
-			},
-			[=](CZNC* pZNC) {
-				pZNC->SetServerThrottle(30);
+		}
+		++count;
+		sum += dSeconds;
+	}
+};
+
+// adds the time until it goes out of scope to a histogram
+class CLatencyTimer
+{
+public:
+	explicit CLatencyTimer(LatencyHistogram& Histogram) : m_Histogram(Histogram)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &m_tsStart);
+	}
+	~CLatencyTimer()
+	{
+		timespec tsEnd;
+		clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+		m_Histogram.Observe((tsEnd.tv_sec - m_tsStart.tv_sec) + (tsEnd.tv_nsec - m_tsStart.tv_nsec) / 1e9);
+	}
+
+private:
+	LatencyHistogram& m_Histogram;
+	timespec m_tsStart;
+};
+
+// the number of seconds a rendered metrics page is served from the cache
+static const unsigned int MetricsTTL = 5;
+
+// the number of objects processed per timer tick by bulk operations
+static const unsigned int BatchSize = 250;
+
+// sampled by a timer, see CAdminMod::SampleListeners()
+struct ListenerStats
+{
+	unsigned long long accepted; // connections seen since the module was loaded
+	double rate;                 // accepts per second during the last interval
+	unsigned int open;           // currently open connections
+	uint64_t newest;             // start time (ms) of the newest connection seen
+	unsigned long long rejected; // connections closed due to --max-rate
+};
+
+// socket tuning of a listener, options that Linux honors when they are
+// set on a socket that is already listening, and the accept rate limit
+struct ListenerOptions
+{
+	int backlog = 0;          // listen() backlog
+	int deferAccept = 0;      // TCP_DEFER_ACCEPT in seconds
+	int fastOpen = 0;         // TCP_FASTOPEN queue length
+	unsigned int maxRate = 0; // accepts per second, the excess is closed
+
+	CString ToString() const
+	{
+		CString sOptions;
+		if (backlog)
+			sOptions += " --backlog " + CString(backlog);
+		if (deferAccept)
+			sOptions += " --defer-accept " + CString(deferAccept);
+		if (fastOpen)
+			sOptions += " --fastopen " + CString(fastOpen);
+		if (maxRate)
+			sOptions += " --max-rate " + CString(maxRate);
+		return sOptions.TrimLeft_n();
+	}
+};
+
+// the interval of listener statistics in seconds
+static const unsigned int ListenerInterval = 5;
+
+struct PortBenchResult
+{
+	unsigned int connected = 0;
+	unsigned int failures = 0; // refused, reset or not connected within 5 seconds
+	double wallMs = 0;
+	double sumMs = 0;          // connect latencies
+	double maxMs = 0;
+	CString error;
+};
+
+struct TLSBenchResult
+{
+	unsigned int handshakes = 0;
+	unsigned int failures = 0;
+	unsigned int resumed = 0;
+	double wallMs = 0;
+	double cpuMs = 0; // the server side of the handshakes
+	CString cipher;
+	CString protocol;
+	CString error;
+};
+
+struct AutoDetachInfo
+{
+	time_t since;
+	unsigned int lines;      // channel messages received while detached
+	unsigned long long bytes; // and their size times the number of clients
+};
+
+// the interval of auto-detach checks in seconds
+static const unsigned int AutoDetachInterval = 60 * 60;
+
+struct UserRow
+{
+	unsigned int line;
+	CString username;
+	CString password; // plain text or <method>#<hash>#<salt>#
+	CString salt;
+	CString source;
+	bool hashed;
+};
+
+// the kinds of audit log records, see CAdminMod::Audit()
+enum AuditKind : uint8_t {
+	AuditSet, AuditReset, AuditCommand
+};
+
+// commands with secrets in their arguments, and the first argument
+// that is masked in audit records and undo labels
+static const std::pair<const char*, unsigned int> SecretArgs[] = {
+	{ "AddUser", 1 },   // <username> <password>
+	{ "AddServer", 2 }, // <host> [[+]port] [pass]
+	{ "DelServer", 2 }  // <host> [[+]port] [pass]
+};
+
+static CString MaskSecretArgs(const CString& sCmd, const CString& sArgs)
+{
+	for (const auto& Secret : SecretArgs) {
+		if (!sCmd.Equals(Secret.first))
+			continue;
+		VCString vsArgs;
+		sArgs.Split(" ", vsArgs, false);
+		if (vsArgs.size() <= Secret.second)
+			break;
+		vsArgs.resize(Secret.second);
+		vsArgs.push_back("***");
+		return CString(" ").Join(vsArgs.begin(), vsArgs.end());
+	}
+	return sArgs;
+}
+
+// every Nth audit record is indexed by time
+static const unsigned int AuditIndexStep = 64;
+// the interval of audit log syncs in seconds
+static const unsigned int AuditSyncInterval = 10;
+// the maximum number of records shown by Audit
+static const unsigned int AuditLines = 100;
+
+// the kinds of undo journal entries, see CAdminMod::CommitUndo()
+enum UndoKind : uint8_t {
+	UndoValues,  // values to apply to existing objects
+	UndoRestore, // values that re-create deleted objects
+	UndoRemove   // an object to delete
+};
+
+// the memory an admin's undo journal may use
+static const size_t UndoBytes = 256 * 1024;
+
+// a Watch subscription, the values last reported and the changes
+// pushed since the previous tick
+struct WatchInfo
+{
+	VCString items;                    // variables and @events, wildcards allowed
+	std::map<CString, CString> state;  // scope TAB item -> value
+	SCString queue;                    // scope TAB item
+	bool primed = false;
+};
+
+// the interval of Watch notifications in seconds
+static const unsigned int WatchInterval = 2;
+// the interval in seconds of rescanning the watched names for changes
+// that were not made through the admin module
+static const unsigned int WatchRescan = 60;
+// the maximum number of notification lines per tick
+static const unsigned int WatchLines = 50;
+
+// the header of a persisted buffer file, see CAdminMod::SaveBuffers()
+static const char BufferMagic[8] = { 'Z', 'N', 'C', 'B', 'U', 'F', '0', '1' };
+
+enum BufferType : uint8_t {
+	ChanBuffer, QueryBuffer
+};
+
+// a memory mapped buffer file and the buffers that have not been restored yet
+struct BufferFile
+{
+	CModule* owner = nullptr; // the instance that mapped the file
+	const char* data = nullptr;
+	size_t size = 0;
+	ino_t inode = 0; // deleted once restored, unless a newer save replaced it
+	std::map<CString, size_t> offsets; // user/network/name in lower case -> record
+	unsigned long long lines = 0;
+	unsigned long long bytes = 0;
+	double ms = 0;
+};
+
+// bounds checked reads from a mapped file
+class CBufferReader
+{
+public:
+	CBufferReader(const char* pData, size_t uSize, size_t uOffset)
+		: m_pPos(pData + std::min(uOffset, uSize)), m_pEnd(pData + uSize) {}
+
+	template <typename T>
+	bool Read(T& Value)
+	{
+		if (size_t(m_pEnd - m_pPos) < sizeof(T))
+			return false;
+		memcpy(&Value, m_pPos, sizeof(T));
+		m_pPos += sizeof(T);
+		return true;
+	}
+	bool Read(CString& sValue)
+	{
+		uint32_t uLen;
+		if (!Read(uLen) || size_t(m_pEnd - m_pPos) < uLen)
+			return false;
+		sValue.assign(m_pPos, uLen);
+		m_pPos += uLen;
+		return true;
+	}
+	bool ReadVarint(uint64_t& uValue)
+	{
+		uValue = 0;
+		for (unsigned int uShift = 0; m_pPos < m_pEnd && uShift < 64; uShift += 7) {
+			const uint8_t uByte = *m_pPos++;
+			uValue |= uint64_t(uByte & 0x7f) << uShift;
+			if (!(uByte & 0x80))
 				return true;
-			}
-		},
+		}
+		return false;
+	}
+	bool Skip(uint64_t uBytes)
+	{
+		if (size_t(m_pEnd - m_pPos) < uBytes)
+			return false;
+		m_pPos += uBytes;
+		return true;
+	}
+	const char* Pos() const { return m_pPos; }
+
+private:
+	const char* m_pPos;
+	const char* m_pEnd;
+};
+
+template <typename T>
+static void AppendBinary(CString& sOut, const T& Value)
+{
+	sOut.append(reinterpret_cast<const char*>(&Value), sizeof(T));
+}
+
+static void AppendBinary(CString& sOut, const CString& sValue)
+{
+	AppendBinary(sOut, uint32_t(sValue.size()));
+	sOut.append(sValue);
+}
+
+static void AppendVarint(CString& sOut, uint64_t uValue)
+{
+	while (uValue >= 0x80) {
+		sOut += char((uValue & 0x7f) | 0x80);
+		uValue >>= 7;
+	}
+	sOut += char(uValue);
+}
+
+// one day of history at one-minute resolution
+static const unsigned int HistorySlots = 24 * 60;
+// the interval of history saves in minutes
+static const unsigned int HistorySaveInterval = 10;
+
+enum HistoryMetric {
+	HistoryTraffic, HistoryClients, HistoryNetworks, HistoryBuffer, HistoryMetricCount
+};
+
+static const char* HistoryNames[] = { "traffic", "clients", "networks", "buffer" };
+
+// the history of a user, a network or all of ZNC (*), as a struct of
+// arrays indexed by the ring position shared by all series
+struct HistorySeries
+{
+	uint32_t traffic[HistorySlots] = {};  // bytes sent and received during the minute
+	uint16_t clients[HistorySlots] = {};  // attached clients
+	uint16_t networks[HistorySlots] = {}; // connected networks
+	uint32_t buffer[HistorySlots] = {};   // estimated playback buffer memory in KiB
+	unsigned long long total = 0;         // the traffic counter at the last sample
+
+	uint32_t Get(unsigned int uMetric, size_t uSlot) const
+	{
+		switch (uMetric) {
+		case HistoryTraffic: return traffic[uSlot];
+		case HistoryClients: return clients[uSlot];
+		case HistoryNetworks: return networks[uSlot];
+		default: return buffer[uSlot];
+		}
+	}
+	void Set(unsigned int uMetric, size_t uSlot, uint32_t uValue)
+	{
+		switch (uMetric) {
+		case HistoryTraffic: traffic[uSlot] = uValue; break;
+		case HistoryClients: clients[uSlot] = std::min<uint32_t>(uValue, UINT16_MAX); break;
+		case HistoryNetworks: networks[uSlot] = std::min<uint32_t>(uValue, UINT16_MAX); break;
+		default: buffer[uSlot] = uValue; break;
+		}
+	}
+};
+
+// parses a duration such as 90s, 30m, 12h, 7d or 2w
+static bool ParseDuration(const CString& sDuration, time_t& tDuration)
+{
+	CString sNum = sDuration;
+	time_t tUnit = 1;
+	if (!sNum.empty() && !isdigit((unsigned char) sNum.back())) {
+		switch (tolower(sNum.back())) {
+		case 's': tUnit = 1; break;
+		case 'm': tUnit = 60; break;
+		case 'h': tUnit = 60 * 60; break;
+		case 'd': tUnit = 24 * 60 * 60; break;
+		case 'w': tUnit = 7 * 24 * 60 * 60; break;
+		default: return false;
+		}
+		sNum.RightChomp(1);
+	}
+
+	if (sNum.empty() || sNum.find_first_not_of("0123456789") != CString::npos)
+		return false;
+	tDuration = sNum.ToULong() * tUnit;
+	return true;
+}
+
+// whether a message mentions a nick, as a whole word in any case
+static bool IsMention(const CString& sText, const CString& sNick)
+{
+	if (sNick.empty())
+		return false;
+
+	// letters, digits and the special characters allowed in nicks
+	auto fnNickChar = [](char c) {
+		return isalnum((unsigned char) c) || (c && strchr("[]\\`_^{|}-", c));
+	};
+
+	const CString sLowerText = sText.AsLower();
+	const CString sLowerNick = sNick.AsLower();
+	for (size_t uPos = sLowerText.find(sLowerNick); uPos != CString::npos; uPos = sLowerText.find(sLowerNick, uPos + 1)) {
+		const size_t uEnd = uPos + sLowerNick.size();
+		if ((uPos == 0 || !fnNickChar(sLowerText[uPos - 1])) && (uEnd == sLowerText.size() || !fnNickChar(sLowerText[uEnd])))
+			return true;
+	}
+	return false;
+}
+
+// whether a name matches any of the (wildcard) patterns, in any case
+static bool MatchesAny(const CString& sName, const VCString& vsPatterns)
+{
+	for (const CString& sPattern : vsPatterns) {
+		if (sName.WildCmp(sPattern, CString::CaseInsensitive))
+			return true;
+	}
+	return false;
+}
+
+#ifdef HAVE_LIBSSL
+// loads a certificate the way ZNC does for its listeners: the key and the
+// DH parameters come from the certificate file unless separate files are
+// configured, and DH parameters are optional only in the certificate file
+static bool UseCertFiles(SSL_CTX* pCtx, const CString& sCertFile, const CString& sKeyFile, const CString& sDHParamFile)
+{
+	if (SSL_CTX_use_certificate_chain_file(pCtx, sCertFile.c_str()) != 1
+			|| SSL_CTX_use_PrivateKey_file(pCtx, (sKeyFile.empty() ? sCertFile : sKeyFile).c_str(), SSL_FILETYPE_PEM) != 1
+			|| SSL_CTX_check_private_key(pCtx) != 1)
+		return false;
+
+	BIO* pBio = BIO_new_file((sDHParamFile.empty() ? sCertFile : sDHParamFile).c_str(), "r");
+	DH* pDH = pBio ? PEM_read_bio_DHparams(pBio, nullptr, nullptr, nullptr) : nullptr;
+	BIO_free(pBio);
+	if (!pDH) {
+		if (!sDHParamFile.empty())
+			return false;
+		ERR_clear_error();
+		return true;
+	}
+
+	const bool bValid = SSL_CTX_set_tmp_dh(pCtx, pDH) == 1;
+	DH_free(pDH);
+	return bValid;
+}
+#endif
+
+// state shared by the admin instances of all users, the settings are
+// stored in ZNC's data directory instead of the module data of a user
+struct SharedState
+{
+	MCString registry;
+	bool loaded = false;
+
+	// template -> variable values
+	std::map<CString, MCString> templates;
+	// user -> template, and the reverse index template -> users
+	MCString inherits;
+	std::map<CString, SCString> inheritors;
+	// user -> variables set locally, overriding the template
+	std::map<CString, SCString> localVars;
+
+	// the persisted buffers of all users, saved by whichever admin
+	// restarts or shuts down ZNC
+	BufferFile buffers;
+
+	// the admin instances with Watch subscriptions
+	std::set<CModule*> watchers;
+
+	// the admin instance whose timer watches the certificate file, and
+	// the modification time it last saw
+	CModule* certWatcher = nullptr;
+	time_t certMTime = 0;
+
+	// user, user/network or * -> one day of samples, taken by whichever
+	// admin's timer fires first in a minute
+	std::map<CString, std::unique_ptr<HistorySeries>> history;
+	size_t historyPos = 0;     // the slot of the latest sample
+	time_t historyTime = 0;    // the minute of the latest sample
+	time_t historySaved = 0;   // the minute of the latest saved sample
+};
+
+static SharedState& GetShared()
+{
+	static SharedState Shared;
+	return Shared;
+}
+
+class CAdminMod : public CModule
+{
+public:
+	MODCONSTRUCTOR(CAdminMod)
+	{
+	}
+	~CAdminMod() override;
+
+	bool OnLoad(const CString& sArgs, CString& sMessage) override;
+	void OnModCommand(const CString& sLine) override;
+	EModRet OnUserRaw(CString& sLine) override;
+
+	EModRet OnUserTextMessage(CTextMessage& Message) override;
+	EModRet OnUserActionMessage(CActionMessage& Message) override;
+	EModRet OnChanTextMessage(CTextMessage& Message) override;
+	EModRet OnChanActionMessage(CActionMessage& Message) override;
+	EModRet OnChanNoticeMessage(CNoticeMessage& Message) override;
+	bool OnBoot() override;
+	void OnClientLogin() override;
+	void OnClientDisconnect() override;
+	void OnIRCConnected() override;
+	void OnIRCDisconnected() override;
+
+	bool WebRequiresLogin() override { return true; }
+	bool WebRequiresAdmin() override { return false; }
+	bool OnWebPreRequest(CWebSock& WebSock, const CString& sPageName) override;
+
+	CString GetInfix() const;
+	void SetInfix(const CString& sInfix);
+
+	using CModule::PutModule;
+	unsigned int PutModule(const CString& sLine) override;
+
+protected:
+	EModRet OnUserCommand(CUser* pUser, const CString& sLine);
+	EModRet OnNetworkCommand(CIRCNetwork* pNetwork, const CString& sLine);
+	EModRet OnChanCommand(CChan* pChan, const CString& sLine);
+	EModRet OnTargetCommand(const CString& sTarget, const CString& sRest);
+	EModRet OnWildChanCommand(const CString& sTarget, const CString& sRest);
+	void OnBulkChanCommand(const std::vector<CChan*>& vChans, const CString& sLine);
+
+private:
+	template <typename C>
+	void OnHelpCommand(const CString& sLine, const std::vector<C>& vCmds);
+	template <typename T, typename V>
+	void OnListCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars);
+	template <typename T, typename V>
+	void OnGetCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars);
+	template <typename T, typename V>
+	void OnSetCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars);
+	template <typename T, typename V>
+	void OnResetCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars);
+	template <typename T, typename C>
+	void OnExecCommand(T* pObject, const CString& sLine, const std::vector<C>& vCmds);
+
+	template <typename T>
+	void OnListModsCommand(T* pObject, const CString& sArgs, CModInfo::EModuleType eType);
+	template <typename T>
+	void OnLoadModCommand(T* pObject, const CString& sArgs, CModInfo::EModuleType eType);
+	template <typename T>
+	void OnReloadModCommand(T* pObject, const CString& sArgs);
+	template <typename T>
+	void OnUnloadModCommand(T* pObject, const CString& sArgs);
+
+	template <typename C>
+	CAdminTable FilterCmdTable(const std::vector<C>& vCmds, const CString& sFilter) const;
+	template <typename V>
+	CAdminTable FilterVarTable(const std::vector<V>& vVars, const CString& sFilter) const;
+
+	enum ApplyResult {
+		ApplyUnchanged, ApplyChanged, ApplyFailed
+	};
+
+	void CollectConfig(const ConfigVisitor& Visitor) const;
+	void CollectGlobalConfig(const ConfigVisitor& Visitor) const;
+	void CollectUserConfig(const CUser* pUser, const ConfigVisitor& Visitor) const;
+	template <typename T, typename V>
+	void CollectVars(const T* pObject, const CString& sScope, const std::vector<V>& vVars, const ConfigVisitor& Visitor) const;
+
+	ApplyResult ApplyConfig(const CString& sScope, const CString& sVar, const CString& sVal, bool bCreate, CString& sError);
+	template <typename T, typename V>
+	ApplyResult ApplyVar(T* pObject, const std::vector<V>& vVars, const CString& sVar, const CString& sVal, CString& sError);
+	ApplyResult ApplyModules(CModules& Modules, CModInfo::EModuleType eType, CUser* pUser, CIRCNetwork* pNetwork, const CString& sVal, CString& sError);
+	ApplyResult ApplyServers(CIRCNetwork* pNetwork, const CString& sVal);
+	ApplyResult ApplyPorts(const CString& sVal, CString& sError);
+
+	void SaveSnapshot(const CString& sName);
+	void RestoreSnapshot(const CString& sName);
+	void CompactSnapshots();
+
+	CListener* ParseListener(const CString& sArgs) const;
+	void ExportConfig(const CString& sFile, const CString& sFilter);
+	void ImportConfig(const CString& sFile);
+	void AddUsers(const CString& sFile);
+	void CreateUsers(std::vector<UserRow>& vRows, size_t uBegin, size_t uEnd, unsigned int& uAdded, VCString& vsErrors);
+	void CloneUsers(const CString& sSource, const CString& sTargets, bool bVarsOnly);
+	void ListUsers(const CString& sArgs);
+	void CheckAutoDetach();
+	void SaveAutoDetach() const;
+	void LoadAutoDetach();
+	void OnChanActivity(CChan* pChan, const CMessage& Message, bool bOwn);
+	unsigned int GetAutoDetachDays(const CIRCNetwork* pNetwork) const;
+	static CString GetChanKey(const CChan* pChan);
+	void SearchBuffers(const std::vector<std::pair<CString, const CBuffer*>>& vBuffers, const CString& sArgs);
+	static void AddNetworkBuffers(const CIRCNetwork* pNetwork, const CString& sPrefix, std::vector<std::pair<CString, const CBuffer*>>& vBuffers);
+	void Audit(AuditKind eKind, const CString& sScope, const CString& sName, const CString& sOld, const CString& sNew);
+	void SearchAudit(const CString& sFilter, time_t tSince);
+	void IndexAudit(const char* pData, size_t uSize);
+	static CString GetAuditPath();
+	static bool IsMutating(const CString& sCmd);
+	static CString GetScope(const CZNC* pZNC) { return ""; }
+	static CString GetScope(const CUser* pUser);
+	static CString GetScope(const CIRCNetwork* pNetwork);
+	static CString GetScope(const CChan* pChan);
+	void JournalValue(const CString& sScope, const CString& sVar, const CString& sOld);
+	void JournalCommand(const CString& sScope, const CString& sCmd, const CString& sArgs, const std::function<void()>& fnExec);
+	void CommitUndo(const CString& sLabel, UndoKind eKind = UndoValues);
+	void Undo(unsigned int uCount);
+	void CollectScope(const CString& sScope, const ConfigVisitor& Visitor) const;
+	CString GetConfigValue(const CString& sScope, const CString& sVar) const;
+	static bool HasScope(const CString& sScope);
+	void RenderMetrics(CString& sOut) const;
+	void ShowMemory();
+	void EstimateMemory(std::vector<std::pair<CString, size_t>>& vParts);
+	void EstimateSharedMemory(std::vector<std::pair<CString, size_t>>& vParts) const;
+	void SampleHistory();
+	void SaveHistory();
+	void LoadHistory();
+	void ShowHistory(const CString& sMetric, const CString& sKey, bool bTable);
+	void ShowTrafficHistory();
+	CString GetSparkline(const HistorySeries& Series, unsigned int uMetric, unsigned long long& uMax, unsigned long long& uSum) const;
+	static unsigned long long EstimateBufferBytes(const CBuffer& Buffer);
+	void GetConfigJSON(const VCString& vsScopes, const VCString& vsVars, CString& sJSON) const;
+	void SetConfigJSON(const VCString& vsValues, CString& sJSON);
+	bool CanAccessScope(const CString& sScope) const;
+	bool OpenControl(CString& sError);
+	void CloseControl();
+	CString OnControlLine(const CString& sLine);
+	void SetWatch(const CString& sScope, const CString& sItems);
+	void NotifyWatches(const CString& sScope, const CString& sItem);
+	void QueueWatch(const CString& sScope, const CString& sItem);
+	void CheckWatches(bool bRescan);
+	void CollectWatch(const CString& sScope, const VCString& vsItems, std::map<CString, CString>& mState) const;
+	template <typename T, typename V>
+	void CollectWatchVars(const T* pObject, const CString& sScope, const std::vector<V>& vVars, const VCString& vsItems, std::map<CString, CString>& mState) const;
+	static CString FormatWatch(const CString& sKey, const CString* pOld, const CString* pNew);
+	CAdminMod* FindOtherAdmin() const;
+	void SaveBuffers();
+	void LoadBuffers();
+	void UnloadBuffers();
+	void TakeBuffers();
+	void RestoreBuffers(bool bAll, unsigned int uMax = UINT_MAX);
+	bool RestoreBuffer(size_t uOffset, bool bAll);
+	template <typename T>
+	static void RestoreLines(T* pTarget, CBufferReader& Reader, uint32_t uCount);
+	static CString GetBufferKey(const CIRCNetwork* pNetwork, const CString& sName);
+	void SampleListeners();
+	static bool ParseListenerOptions(const CString& sArgs, CString& sPositional, ListenerOptions& Options);
+	static bool ApplyListenerOptions(const CListener* pListener, const ListenerOptions& Options, CString& sError);
+	void BenchPort(unsigned short uPort, unsigned int uCount, unsigned int uParallel);
+	static void RunPortBench(const CString& sHost, unsigned short uPort, unsigned int uCount, unsigned int uParallel, PortBenchResult& Result);
+
+	bool CheckCert(const CString& sFile, VCString& vsInfo, CString& sError);
+	void ReloadCert(const CString& sFile, const CString& sTarget = "");
+	void WatchCert(bool bWatch);
+	void BenchTLS(unsigned int uCount);
+	static void RunTLSBench(const CString& sCertFile, const CString& sKeyFile, const CString& sDHParamFile, const CString& sCiphers, const CString& sProtocols, unsigned int uCount, TLSBenchResult& Result);
+
+	template <typename T>
+	void OnVarChanged(T* pObject, const CString& sVar, bool bReset) {}
+	void OnVarChanged(CUser* pUser, const CString& sVar, bool bReset);
+	template <typename T>
+	CString GetVarOrigin(const T* pObject, const CString& sVar) const { return ""; }
+	CString GetVarOrigin(const CUser* pUser, const CString& sVar) const;
+
+	void LoadTemplates();
+	void SetTemplateVar(const CString& sTemplate, const CString& sVar, const CString& sVal);
+	void ResetTemplateVar(const CString& sTemplate, const CString& sVar);
+	void DelTemplate(const CString& sTemplate);
+	void SetInherit(CUser* pUser, const CString& sTemplate);
+	void ApplyTemplate(const CString& sTemplate, const CString& sVar);
+	void SaveLocalVars(const CString& sUser);
+	void RunBatches(const CString& sLabel, const std::function<bool()>& fnBatch);
+
+	static const MCString& GetSharedRegistry();
+	static CString GetSharedNV(const CString& sKey);
+	static void SetSharedNV(const CString& sKey, const CString& sValue, bool bWriteToDisk = true);
+	static void DelSharedNV(const CString& sKey, bool bWriteToDisk = true);
+	static void SaveSharedNV();
+
+	CString GetFilePath(const CString& sFile) const;
+	static CString GetListenerString(const CListener* pListener);
+	static CString GetModulesString(const CModules& Modules);
+	static CString GetPassString(const CUser* pUser);
+	static bool SetPassString(CUser* pUser, const CString& sPass);
+
+	void PutSuccess(const CString& sLine, const CString& sTarget = "");
+	void PutUsage(const CString& sSyntax, const CString& sTarget = "");
+	void PutError(const CString& sLine, const CString& sTarget = "");
+	void PutLine(const CString& sLine, const CString& sTarget = "");
+	void PutTable(const CAdminTable& Table, const CString& sTarget = "");
+
+	CString m_sTarget;
+	// reused by PutSuccess(), PutError() and PutUsage() to build lines,
+	// and by PutTable() to render a whole table
+	CString m_sScratch;
+	// the cells of the tables of a command, emptied when the next
+	// command starts
+	mutable CString m_sArena;
+
+	CStringPool m_Pool;
+	std::map<CString, ConfigSnapshot> m_mSnapshots;
+
+	SharedState& m_Shared = GetShared();
+
+	std::map<const CListener*, ListenerStats> m_mListenerStats;
+	std::map<const CListener*, ListenerOptions> m_mListenerOptions;
+
+	// network/#chan -> the last time the user spoke in the channel
+	std::unordered_map<CString, time_t, std::hash<std::string>> m_mChanActivity;
+	std::map<CString, AutoDetachInfo> m_mAutoDetached;
+
+	// scope pattern -> subscription
+	std::map<CString, WatchInfo> m_mWatches;
+	unsigned int m_uWatchTicks = 0;
+
+	int m_iAuditFD = -1;
+	bool m_bAuditDirty = false;
+	// (time, offset) of every AuditIndexStep'th record up to m_uAuditIndexed
+	std::vector<std::pair<int64_t, size_t>> m_vAuditIndex;
+	size_t m_uAuditIndexed = 0;
+	unsigned long long m_uAuditRecords = 0;
+
+	// encoded entries, oldest first, and the (scope, var, value)
+	// triplets of the command being executed
+	std::deque<CString> m_dUndo;
+	size_t m_uUndoBytes = 0;
+	VCString m_vsUndoPending;
+
+	LatencyHistogram m_Latency;
+
+	// the rendered metrics page, reused across scrapes
+	CString m_sMetrics;
+	time_t m_tMetrics = 0;
+
+	// owned by the socket manager once opened
+	CAdminControl* m_pControl = nullptr;
+	// collects output instead of sending it while a control command runs
+	ControlCapture* m_pCapture = nullptr;
+	// the number of error and usage replies, for the outcome of audited commands
+	unsigned int m_uErrors = 0;
+
+	// the last modification time of the watched certificate, and the time
+	// (ms) it took to set up a TLS context from it
+	double m_dCertSetupMs = 0;
+
+	// TODO: expose the default constants needed by the reset methods?
+
+	const std::vector<Variable<CZNC>> GlobalVars = {
 		{
-			"Skin", StringType,
-			"The default web interface skin.",
+			"AnonIPLimit", IntType,
+			"The limit of anonymous unidentified connections per IP.",
 			[=](const CZNC* pZNC) {
-				return pZNC->GetSkinName();
+				return CString(pZNC->GetAnonIPLimit());
 			},
 			[=](CZNC* pZNC, const CString& sVal) {
-				pZNC->SetSkinName(sVal);
+				pZNC->SetAnonIPLimit(sVal.ToUInt());
 				return true;
 			},
 			[=](CZNC* pZNC) {
-				pZNC->SetSkinName("");
+				pZNC->SetAnonIPLimit(10);
 				return true;
 			}
 		},
+		// TODO: BindHost
 		{
-			"SSLCertFile", StringType,
-			"The TLS/SSL certificate file from which ZNC reads its server certificate.",
+			"ConnectDelay", IntType,
+			"The number of seconds every IRC connection is delayed.",
 			[=](const CZNC* pZNC) {
-				return pZNC->GetSSLCertFile();
+				return CString(pZNC->GetConnectDelay());
 			},
 			[=](CZNC* pZNC, const CString& sVal) {
-				pZNC->SetSSLCertFile(sVal);
+				pZNC->SetConnectDelay(sVal.ToUInt());
 				return true;
 			},
 			[=](CZNC* pZNC) {
-				pZNC->SetSSLCertFile(pZNC->GetZNCPath() + "/znc.pem");
+				pZNC->SetConnectDelay(5);
 				return true;
-			},
+			}
 		},
 		{
-			"SSLCiphers", StringType,
-			"The allowed SSL ciphers. Default value is from Mozilla's recomendations.",
+			"HideVersion", BoolType,
+			"Whether the version number is hidden from the web interface and CTCP VERSION replies.",
 			[=](const CZNC* pZNC) {
-				return pZNC->GetSSLCiphers();
+				return CString(pZNC->GetHideVersion());
 			},
 			[=](CZNC* pZNC, const CString& sVal) {
-				pZNC->SetSSLCiphers(sVal);
+				pZNC->SetHideVersion(sVal.ToBool());
 				return true;
 			},
 			[=](CZNC* pZNC) {
-				pZNC->SetSSLCiphers("");
+				pZNC->SetHideVersion(false);
 				return true;
-			},
+			}
 		},
 		{
-			"SSLProtocols", StringType,
-			"The accepted SSL protocols.",
+			"MaxBufferSize", IntType,
+			"The maximum playback buffer size. Only admin users can exceed the limit.",
 			[=](const CZNC* pZNC) {
-				return pZNC->GetSSLProtocols();
+				return CString(pZNC->GetMaxBufferSize());
 			},
 			[=](CZNC* pZNC, const CString& sVal) {
-				if (!pZNC->SetSSLProtocols(sVal)) {
-					VCString vsProtocols = pZNC->GetAvailableSSLProtocols();
-					PutError("invalid value");
-					PutError("the syntax is: [+|-]<protocol> ...");
-					PutError("available protocols: " + CString(", ").Join(vsProtocols.begin(), vsProtocols.end()));
-					return false;
-				}
+				pZNC->SetMaxBufferSize(sVal.ToUInt());
 				return true;
 			},
 			[=](CZNC* pZNC) {
-				pZNC->SetSSLProtocols("");
+				pZNC->SetMaxBufferSize(500);
 				return true;
-			},
+			}
 		},
 		{
-			"StatusPrefix", StringType,
+			"Motd", ListType,
+			"The list of 'message of the day' lines that are sent to clients on connect via notice from *status.",
+			[=](const CZNC* pZNC) {
+				const VCString& vsMotd = pZNC->GetMotd();
+				return CString("\n").Join(vsMotd.begin(), vsMotd.end());
+			},
+			[=](CZNC* pZNC, const CString& sVal) {
+				pZNC->AddMotd(sVal);
+				return true;
+			},
+			[=](CZNC* pZNC) {
+				pZNC->ClearMotd();
+				return true;
+			},
+		},
+		// TODO: PidFile
+		{
+			"ProtectWebSessions", BoolType,
+			"Whether IP changing during each web session is disallowed.",
+			[=](const CZNC* pZNC) {
+				return CString(pZNC->GetProtectWebSessions());
+			},
+			[=](CZNC* pZNC, const CString& sVal) {
+				pZNC->SetProtectWebSessions(sVal.ToBool());
+				return true;
+			},
+			[=](CZNC* pZNC) {
+				pZNC->SetProtectWebSessions(true);
+				return true;
+			}
+		},
+		{
+			"ServerThrottle", IntType,
+			"The number of seconds between connect attempts to the same hostname.",
+			[=](const CZNC* pZNC) {
+				return CString(pZNC->GetServerThrottle());
+			},
+			[=](CZNC* pZNC, const CString& sVal) {
+				pZNC->SetServerThrottle(sVal.ToUInt());
+				return true;
+			},
+			[=](CZNC* pZNC) {
+				pZNC->SetServerThrottle(30);
+				return true;
+			}
+		},
+		{
+			"Skin", StringType,
+			"The default web interface skin.",
+			[=](const CZNC* pZNC) {
+				return pZNC->GetSkinName();
+			},
+			[=](CZNC* pZNC, const CString& sVal) {
+				pZNC->SetSkinName(sVal);
+				return true;
+			},
+			[=](CZNC* pZNC) {
+				pZNC->SetSkinName("");
+				return true;
+			}
+		},
+		{
+			"SSLCertFile", StringType,
+			"The TLS/SSL certificate file from which ZNC reads its server certificate.",
+			[=](const CZNC* pZNC) {
+				return pZNC->GetSSLCertFile();
+			},
+			[=](CZNC* pZNC, const CString& sVal) {
+				pZNC->SetSSLCertFile(sVal);
+				return true;
+			},
+			[=](CZNC* pZNC) {
+				pZNC->SetSSLCertFile(pZNC->GetZNCPath() + "/znc.pem");
+				return true;
+			},
+		},
+		{
+			"SSLCiphers", StringType,
+			"The allowed SSL ciphers. Default value is from Mozilla's recomendations.",
+			[=](const CZNC* pZNC) {
+				return pZNC->GetSSLCiphers();
+			},
+			[=](CZNC* pZNC, const CString& sVal) {
+				pZNC->SetSSLCiphers(sVal);
+				return true;
+			},
+			[=](CZNC* pZNC) {
+				pZNC->SetSSLCiphers("");
+				return true;
+			},
+		},
+		{
+			"SSLProtocols", StringType,
+			"The accepted SSL protocols.",
+			[=](const CZNC* pZNC) {
+				return pZNC->GetSSLProtocols();
+			},
+			[=](CZNC* pZNC, const CString& sVal) {
+				if (!pZNC->SetSSLProtocols(sVal)) {
+					VCString vsProtocols = pZNC->GetAvailableSSLProtocols();
+					PutError("invalid value");
+					PutError("the syntax is: [+|-]<protocol> ...");
+					PutError("available protocols: " + CString(", ").Join(vsProtocols.begin(), vsProtocols.end()));
+					return false;
+				}
+				return true;
+			},
+			[=](CZNC* pZNC) {
+				pZNC->SetSSLProtocols("");
+				return true;
+			},
+		},
+		{
+			"StatusPrefix", StringType,
 			"The default prefix for status and module queries.",
 			[=](const CZNC* pZNC) {
 				return pZNC->GetSkinName();
@@ -1154,53 +2173,35 @@ private:
 
 	const std::vector<Command<CZNC>> GlobalCmds = {
 		{
-			"AddPort <[+]port> <ipv4|ipv6|all> <web|irc|all> [bindhost [uriprefix]]",
+			"AddPort <[+]port> <ipv4|ipv6|all> <web|irc|all> [bindhost [uriprefix]] [--backlog <n>] [--defer-accept <secs>] [--fastopen <n>] [--max-rate <n>]",
 			"Adds a port for ZNC to listen on.",
 			[=](CZNC* pZNC, const CString& sArgs) {
-				CString sPort = sArgs.Token(0);
-				CString sAddr = sArgs.Token(1);
-				CString sAccept = sArgs.Token(2);
-				CString sBindHost = sArgs.Token(3);
-				CString sURIPrefix = sArgs.Token(4);
-
-				unsigned short uPort = sPort.ToUShort();
-				bool bSSL = sPort.StartsWith("+");
-
-				EAddrType eAddr = ADDR_ALL;
-				if (sAddr.Equals("IPV4"))
-					eAddr = ADDR_IPV4ONLY;
-				else if (sAddr.Equals("IPV6"))
-					eAddr = ADDR_IPV6ONLY;
-				else if (sAddr.Equals("ALL"))
-					eAddr = ADDR_ALL;
-				else
-					sAddr.clear();
-
-				CListener::EAcceptType eAccept = CListener::ACCEPT_ALL;
-				if (sAccept.Equals("WEB"))
-					eAccept = CListener::ACCEPT_HTTP;
-				else if (sAccept.Equals("IRC"))
-					eAccept = CListener::ACCEPT_IRC;
-				else if (sAccept.Equals("ALL"))
-					eAccept = CListener::ACCEPT_ALL;
-				else
-					sAccept.clear();
-
-				if (sPort.empty() || sAddr.empty() || sAccept.empty()) {
-					PutUsage("AddPort <[+]port> <ipv4|ipv6|all> <web|irc|all> [bindhost [uriprefix]]");
+				CString sPositional;
+				ListenerOptions Options;
+				CListener* pListener = nullptr;
+				if (ParseListenerOptions(sArgs, sPositional, Options))
+					pListener = ParseListener(sPositional);
+				if (!pListener) {
+					PutUsage("AddPort <[+]port> <ipv4|ipv6|all> <web|irc|all> [bindhost [uriprefix]] [--backlog <n>] [--defer-accept <secs>] [--fastopen <n>] [--max-rate <n>]");
 					return;
 				}
 
-				CListener* pListener = new CListener(uPort, sBindHost, sURIPrefix, bSSL, eAddr, eAccept);
 				if (!pListener->Listen()) {
 					delete pListener;
 					PutError("unable to bind '" + CString(strerror(errno)) + "'");
 				} else {
 					CString sError;
-					if (!pZNC->AddListener(pListener))
+					if (!pZNC->AddListener(pListener)) {
 						PutError("internal error");
-					else
+					} else {
+						if (!Options.ToString().empty()) {
+							SetSharedNV("listener:" + GetListenerString(pListener), Options.ToString());
+							m_mListenerOptions[pListener] = Options;
+							if (!ApplyListenerOptions(pListener, Options, sError))
+								PutError(sError);
+						}
 						PutSuccess("port added");
+					}
 				}
 			}
 		},
@@ -1227,6 +2228,7 @@ private:
 
 				CString sError;
 				if (pZNC->AddUser(pUser, sError)) {
+					NotifyWatches(GetScope(pUser), "@user");
 					PutSuccess("user '" + pUser->GetUserName() + "' added");
 				} else {
 					PutError(sError);
@@ -1234,6 +2236,34 @@ private:
 				}
 			}
 		},
+		{
+			"AddUsers <file>",
+			"Adds users from a CSV or TSV file with username, password and an optional template user.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const CString sFile = sArgs.Token(0);
+				if (sFile.empty()) {
+					PutUsage("AddUsers <file>");
+					return;
+				}
+				AddUsers(sFile);
+			}
+		},
+		{
+			"Audit [filter] [since]",
+			"Shows the latest configuration changes of all or matching (wildcards) users, scopes or commands.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				CString sFilter = sArgs.Token(0);
+				CString sSince = sArgs.Token(1);
+				time_t tSince = 0;
+				if (sSince.empty() && !sFilter.empty() && isdigit(sFilter[0]) && ParseDuration(sFilter, tSince))
+					sFilter.clear();
+				else if (!sSince.empty() && !ParseDuration(sSince, tSince)) {
+					PutUsage("Audit [filter] [since]");
+					return;
+				}
+				SearchAudit(sFilter, tSince ? time(nullptr) - tSince : 0);
+			}
+		},
 		{
 			"Broadcast <message>",
 			"Broadcasts a message to all ZNC users.",
@@ -1245,6 +2275,40 @@ private:
 				pZNC->Broadcast(sArgs);
 			}
 		},
+		{
+			"CloneUser <source> <target[,target...]> [--vars-only]",
+			"Clones a user into all listed or matching (wildcards) users like CloneUser of a single user, but keeps their passwords.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const CString sSource = sArgs.Token(0);
+				const CString sTargets = sArgs.Token(1);
+				const bool bVarsOnly = sArgs.Token(2).Equals("--vars-only");
+				if (sTargets.empty() || (!bVarsOnly && !sArgs.Token(2).empty())) {
+					PutUsage("CloneUser <source> <target[,target...]> [--vars-only]");
+					return;
+				}
+				CloneUsers(sSource, sTargets, bVarsOnly);
+			}
+		},
+		{
+			"ControlSocket [on|off]",
+			"Whether commands are accepted on a Unix domain socket in the module data directory.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const CString sState = sArgs.Token(0);
+				if (!sState.empty()) {
+					CString sError;
+					if (!sState.ToBool()) {
+						CloseControl();
+						DelNV("controlsocket");
+					} else if (OpenControl(sError)) {
+						SetNV("controlsocket", "true");
+					} else {
+						PutError(sError);
+						return;
+					}
+				}
+				PutLine("ControlSocket = " + (m_pControl ? GetSavePath() + "/control.sock" : CString("off")));
+			}
+		},
 		{
 			"DelPort <[+]port> <ipv4|ipv6|all> [bindhost]",
 			"Deletes a port.",
@@ -1272,6 +2336,8 @@ private:
 
 				CListener* pListener = pZNC->FindListener(uPort, sBindHost, eAddr);
 				if (pListener) {
+					DelSharedNV("listener:" + GetListenerString(pListener));
+					m_mListenerOptions.erase(pListener);
 					pZNC->DelListener(pListener);
 					PutSuccess("port deleted");
 				} else {
@@ -1300,10 +2366,77 @@ private:
 					return;
 				}
 
-				if (pZNC->DeleteUser(pUser->GetUserName()))
-					PutSuccess("user '" + pUser->GetUserName() + "' deleted");
-				else
+				const CString sUser = pUser->GetUserName();
+				if (pZNC->DeleteUser(sUser)) {
+					NotifyWatches(sUser, "@user");
+					PutSuccess("user '" + sUser + "' deleted");
+				} else {
 					PutError("internal error");
+				}
+			}
+		},
+		{
+			"Export <file> [filter]",
+			"Exports the configuration of all or matching users to a file.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const CString sFile = sArgs.Token(0);
+				if (sFile.empty()) {
+					PutUsage("Export <file> [filter]");
+					return;
+				}
+				ExportConfig(sFile, sArgs.Token(1));
+			}
+		},
+		{
+			"History <on|off|traffic|clients|networks|buffer> [user[/network]] [--table]",
+			"Enables the one-minute history of the last 24 hours, or shows a metric of ZNC, a user or a network.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const CString sMetric = sArgs.Token(0);
+				if (sMetric.Equals("on") || sMetric.Equals("off")) {
+					if (sMetric.Equals("on")) {
+						SetSharedNV("history", "true");
+						LoadHistory();
+						SampleHistory();
+					} else {
+						// the timers of other admins stop on their next tick
+						DelSharedNV("history");
+						RemTimer("history");
+						m_Shared.history.clear();
+						m_Shared.historyTime = 0;
+						m_Shared.historySaved = 0;
+						CFile::Delete(CZNC::Get().GetZNCPath() + "/admin.history");
+					}
+					PutSuccess("history " + sMetric.AsLower());
+					return;
+				}
+
+				bool bTable = false;
+				CString sKey = "*";
+				VCString vsArgs;
+				sArgs.Token(1, true).Split(" ", vsArgs, false);
+				for (const CString& sArg : vsArgs) {
+					if (sArg.Equals("--table"))
+						bTable = true;
+					else
+						sKey = sArg;
+				}
+				if (sMetric.empty()) {
+					PutUsage("History <on|off|traffic|clients|networks|buffer> [user[/network]] [--table]");
+					return;
+				}
+				ShowHistory(sMetric, sKey, bTable);
+			}
+		},
+		{
+			"Import <file>",
+			"Imports a configuration file written by Export.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const CString sFile = sArgs.Token(0);
+				if (sFile.empty()) {
+					PutUsage("Import <file>");
+					return;
+				}
+				ImportConfig(sFile);
 			}
 		},
 		{
@@ -1314,22 +2447,10 @@ private:
 			}
 		},
 		{
-			"ListUsers [filter]",
-			"Lists all ZNC users.",
+			"ListUsers [filter] [--admin] [--connected] [--networks <[<|>]n>] [--traffic <[<|>]bytes>] [--sort [-]<column>] [--limit <n>]",
+			"Lists all or matching ZNC users.",
 			[=](CZNC* pZNC, const CString& sArgs) {
-				CTable Table;
-				Table.AddColumn("Username");
-				Table.AddColumn("Networks");
-				Table.AddColumn("Clients");
-
-				for (const auto& it : pZNC->GetUserMap()) {
-					Table.AddRow();
-					Table.SetCell("Username", it.first);
-					Table.SetCell("Networks", CString(it.second->GetNetworks().size()));
-					Table.SetCell("Clients", CString(it.second->GetAllClients().size()));
-				}
-
-				PutTable(Table);
+				ListUsers(sArgs);
 			}
 		},
 		{
@@ -1338,9 +2459,8 @@ private:
 			[=](CZNC* pZNC, const CString& sArgs) {
 				const CString& sFilter = sArgs.Token(0);
 
-				CTable Table;
-				Table.AddColumn("Port");
-				Table.AddColumn("Options");
+				CAdminTable Table(m_sArena, { "Port", "Options", "Accepted", "Accepts/s", "Rejected", "Open" });
+				Table.Reserve(pZNC->GetListeners().size(), 64);
 
 				for (const CListener* pListener : pZNC->GetListeners()) {
 					VCString vsOptions;
@@ -1356,6 +2476,13 @@ private:
 						if (!pListener->GetURIPrefix().empty())
 							vsOptions.push_back(pListener->GetURIPrefix() + "/");
 					}
+					auto itOptions = m_mListenerOptions.find(pListener);
+					if (itOptions != m_mListenerOptions.end()) {
+						VCString vsTuning;
+						itOptions->second.ToString().Split(" --", vsTuning, false);
+						for (const CString& sTuning : vsTuning)
+							vsOptions.push_back(sTuning.TrimPrefix_n("--").Replace_n(" ", "="));
+					}
 
 					if (!sFilter.empty()) {
 						bool bMatch = false;
@@ -1371,21 +2498,28 @@ private:
 							}
 						}
 
-						if (!bMatch) {
-							PutLine("No matches for '" + sFilter + "'");
-							return;
-						}
+						if (!bMatch)
+							continue;
 					}
 
+					const ListenerStats& Stats = m_mListenerStats[pListener];
+
 					Table.AddRow();
 					if (pListener->IsSSL())
-						Table.SetCell("Port", "+" + CString(pListener->GetPort()));
+						Table.SetCell(0, "+" + CString(pListener->GetPort()));
 					else
-						Table.SetCell("Port", CString(pListener->GetPort()));
-					Table.SetCell("Options", CString(", ").Join(vsOptions.begin(), vsOptions.end()));
+						Table.SetCell(0, CString(pListener->GetPort()));
+					Table.SetCell(1, CString(", ").Join(vsOptions.begin(), vsOptions.end()));
+					Table.SetCell(2, CString(Stats.accepted));
+					Table.SetCell(3, CString(Stats.rate));
+					Table.SetCell(4, CString(Stats.rejected));
+					Table.SetCell(5, CString(Stats.open));
 				}
 
-				PutTable(Table);
+				if (Table.empty())
+					PutLine("No matches for '" + sFilter + "'");
+				else
+					PutTable(Table);
 			}
 		},
 		{
@@ -1395,6 +2529,47 @@ private:
 				OnLoadModCommand(pZNC, sArgs, CModInfo::GlobalModule);
 			}
 		},
+		{
+			"ModMemory",
+			"Shows the estimated memory used by the admin module of each user and in total.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				ShowMemory();
+			}
+		},
+		{
+			"PersistBuffers [on|off]",
+			"Whether playback buffers are saved on Restart and Shutdown, and restored on startup.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const CString sState = sArgs.Token(0);
+				if (!sState.empty()) {
+					if (sState.ToBool())
+						SetSharedNV("persistbuffers", "true");
+					else
+						DelSharedNV("persistbuffers");
+				}
+				PutLine("PersistBuffers = " + CString(GetSharedNV("persistbuffers").ToBool()));
+				if (!GetSharedNV("buffers:saved").empty())
+					PutLine("Last save: " + GetSharedNV("buffers:saved"));
+				if (!GetSharedNV("buffers:restored").empty())
+					PutLine("Last restore: " + GetSharedNV("buffers:restored"));
+				if (!m_Shared.buffers.offsets.empty())
+					PutLine(CString(m_Shared.buffers.offsets.size()) + " buffers pending restore");
+			}
+		},
+		{
+			"PortBench <[+]port> [count] [parallel]",
+			"Benchmarks a storm of local connections to a port, to compare AddPort tuning.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const unsigned short uPort = sArgs.Token(0).TrimPrefix_n("+").ToUShort();
+				const unsigned int uCount = sArgs.Token(1).empty() ? 1000 : sArgs.Token(1).ToUInt();
+				const unsigned int uParallel = sArgs.Token(2).empty() ? 50 : sArgs.Token(2).ToUInt();
+				if (!uPort || uCount < 1 || uCount > 100000 || uParallel < 1 || uParallel > 1000) {
+					PutUsage("PortBench <[+]port> [count] [parallel] (1-100000, 1-1000)");
+					return;
+				}
+				BenchPort(uPort, uCount, uParallel);
+			}
+		},
 		{
 			"Rehash",
 			"Reloads the ZNC configuration file.",
@@ -1406,6 +2581,23 @@ private:
 					PutSuccess("read '" + pZNC->GetConfigFile() + "'");
 			}
 		},
+		{
+			"ReloadCert [file|--watch <on|off>]",
+			"Validates and switches to a TLS certificate file, or watches SSLCertFile for changes.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				if (sArgs.Token(0).Equals("--watch")) {
+					const CString sWatch = sArgs.Token(1);
+					if (sWatch.empty()) {
+						PutUsage("ReloadCert [file|--watch <on|off>]");
+						return;
+					}
+					WatchCert(sWatch.ToBool());
+					PutSuccess(sWatch.ToBool() ? "watching '" + pZNC->GetSSLCertFile() + "'" : "not watching");
+					return;
+				}
+				ReloadCert(sArgs.Token(0));
+			}
+		},
 		{
 			"ReloadMod <module> [args]",
 			"Reloads a global module.",
@@ -1417,6 +2609,10 @@ private:
 			"Restart [--force] [message]",
 			"Restarts ZNC.",
 			[=](CZNC* pZNC, const CString& sArgs) {
+				if (sArgs.Token(0).Equals("--live")) {
+					PutError("--live is not supported: keeping the connections would need the core to hand its sockets and IRC state over to the new process, which modules have no access to");
+					return;
+				}
 				bool bForce = sArgs.Token(0).Equals("--force");
 				CString sMessage = sArgs.Token(bForce ? 1 : 0, true);
 				if (sMessage.empty())
@@ -1426,6 +2622,8 @@ private:
 					PutError("saving config failed");
 					PutLine("Aborting. Use --force to ignore.");
 				} else {
+					if (GetSharedNV("persistbuffers").ToBool())
+						SaveBuffers();
 					pZNC->Broadcast(sMessage);
 					throw CException(CException::EX_Restart);
 				}
@@ -1454,57 +2652,246 @@ private:
 					PutError("saving config failed");
 					PutLine("Aborting. Use --force to ignore.");
 				} else {
+					if (GetSharedNV("persistbuffers").ToBool())
+						SaveBuffers();
 					pZNC->Broadcast(sMessage);
 					throw CException(CException::EX_Shutdown);
 				}
 			}
 		},
 		{
-			"Traffic",
-			"Shows the amount of traffic.",
+			"Snapshot <list|save|restore|del> [name]",
+			"Saves or restores a snapshot of the whole configuration.",
 			[=](CZNC* pZNC, const CString& sArgs) {
-				CTable Table;
-				Table.AddColumn("User");
-				Table.AddColumn("Sent");
-				Table.AddColumn("Received");
-				Table.AddColumn("Total");
-				for (const auto& it : pZNC->GetUserMap()) {
-					Table.AddRow();
-					Table.SetCell("User", it.first);
-					Table.SetCell("Sent", CString::ToByteStr(it.second->BytesWritten()));
-					Table.SetCell("Received", CString::ToByteStr(it.second->BytesRead()));
-					Table.SetCell("Total", CString::ToByteStr(it.second->BytesRead() + it.second->BytesWritten()));
+				const CString sOp = sArgs.Token(0);
+				const CString sName = sArgs.Token(1);
+
+				if (sOp.Equals("list")) {
+					CAdminTable Table(m_sArena, { "Snapshot", "Created", "Values" });
+					for (const auto& it : m_mSnapshots) {
+						Table.AddRow();
+						Table.SetCell(0, it.first);
+						Table.SetCell(1, CUtils::FormatTime(it.second.created, "%Y-%m-%d %H:%M:%S", GetUser()->GetTimezone()));
+						Table.SetCell(2, CString(it.second.records.size()));
+					}
+					if (Table.empty())
+						PutLine("No snapshots");
+					else
+						PutTable(Table);
+				} else if (sName.empty()) {
+					PutUsage("Snapshot <list|save|restore|del> [name]");
+				} else if (sOp.Equals("save")) {
+					SaveSnapshot(sName);
+				} else if (m_mSnapshots.find(sName) == m_mSnapshots.end()) {
+					PutError("unknown snapshot '" + sName + "'");
+				} else if (sOp.Equals("restore")) {
+					RestoreSnapshot(sName);
+				} else if (sOp.Equals("del")) {
+					m_mSnapshots.erase(sName);
+					CompactSnapshots();
+					PutSuccess("snapshot '" + sName + "' deleted");
+				} else {
+					PutUsage("Snapshot <list|save|restore|del> [name]");
 				}
-				PutTable(Table);
-			}
-		},
-		{
-			"UnloadMod <module> [args]",
-			"Unloads a global module.",
-			[=](CZNC* pZNC, const CString& sArgs) {
-				OnUnloadModCommand(pZNC, sArgs);
 			}
 		},
 		{
-			"UpdateMod <module>",
-			"Reloads all instances of a module.",
+			"Template <list|show|set|reset|del> [name [variable [value]]]",
+			"Manages named templates of user variables.",
 			[=](CZNC* pZNC, const CString& sArgs) {
-				const CString sMod = sArgs.Token(0);
-				if (sMod.empty()) {
-					PutUsage("UpdateMod <module>");
+				const CString sOp = sArgs.Token(0);
+				const CString sName = sArgs.Token(1);
+				const CString sVar = sArgs.Token(2);
+				const CString sVal = sArgs.Token(3, true);
+
+				if (sOp.Equals("list")) {
+					CAdminTable Table(m_sArena, { "Template", "Variables", "Users" });
+					for (const auto& it : m_Shared.templates) {
+						auto itUsers = m_Shared.inheritors.find(it.first);
+						Table.AddRow();
+						Table.SetCell(0, it.first);
+						Table.SetCell(1, CString(it.second.size()));
+						Table.SetCell(2, CString(itUsers != m_Shared.inheritors.end() ? itUsers->second.size() : 0));
+					}
+					if (Table.empty())
+						PutLine("No templates");
+					else
+						PutTable(Table);
 					return;
 				}
 
-				CModInfo Info;
-				CString sError;
-				if (!pZNC->GetModules().GetModInfo(Info, sMod, sError))
-					PutError(sError);
+				if (sName.empty() || (!sOp.Equals("show") && !sOp.Equals("del") && sVar.empty())) {
+					PutUsage("Template <list|show|set|reset|del> [name [variable [value]]]");
+					return;
+				}
+
+				if (sOp.Equals("set")) {
+					const Variable<CUser>* pVar = nullptr;
+					for (const auto& Var : UserVars) {
+						if (Var.name.Equals(sVar))
+							pVar = &Var;
+					}
+					if (!pVar || pVar->name.Equals("Password") || pVar->name.Equals("AdminInfix")) {
+						PutError("unknown variable");
+						return;
+					}
+					if (sVal.empty()) {
+						PutUsage("Template set <name> <variable> <value>");
+						return;
+					}
+					if (sName.find(':') != CString::npos) {
+						PutError("invalid name (must not contain ':')");
+						return;
+					}
+					SetTemplateVar(sName, pVar->name, sVal);
+					PutLine(pVar->name + " = " + sVal);
+					return;
+				}
+
+				if (m_Shared.templates.find(sName) == m_Shared.templates.end()) {
+					PutError("unknown template '" + sName + "'");
+				} else if (sOp.Equals("show")) {
+					CAdminTable Table(m_sArena, { "Variable", "Value" });
+					for (const auto& it : m_Shared.templates[sName]) {
+						Table.AddRow();
+						Table.SetCell(0, it.first);
+						Table.SetCell(1, it.second);
+					}
+					if (Table.empty())
+						PutLine("No variables");
+					else
+						PutTable(Table);
+				} else if (sOp.Equals("reset")) {
+					ResetTemplateVar(sName, sVar);
+					PutSuccess("'" + sVar + "' removed from template '" + sName + "'");
+				} else if (sOp.Equals("del")) {
+					DelTemplate(sName);
+					PutSuccess("template '" + sName + "' deleted");
+				} else {
+					PutUsage("Template <list|show|set|reset|del> [name [variable [value]]]");
+				}
+			}
+		},
+		{
+			"TLSBench [count]",
+			"Benchmarks local TLS handshakes with the current SSLCertFile, SSLCiphers and SSLProtocols.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const unsigned int uCount = sArgs.empty() ? 100 : sArgs.Token(0).ToUInt();
+				if (uCount < 2 || uCount > 10000) {
+					PutUsage("TLSBench [count] (2-10000)");
+					return;
+				}
+				BenchTLS(uCount);
+			}
+		},
+		{
+			"Traffic [--history]",
+			"Shows the amount of traffic, or of the last 24 hours per user.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				if (sArgs.Token(0).Equals("--history")) {
+					ShowTrafficHistory();
+					return;
+				}
+
+				CAdminTable Table(m_sArena, { "User", "Sent", "Received", "Total" });
+				Table.Reserve(pZNC->GetUserMap().size(), 48);
+				for (const auto& it : pZNC->GetUserMap()) {
+					Table.AddRow();
+					Table.SetCell(0, it.first);
+					Table.SetCell(1, CString::ToByteStr(it.second->BytesWritten()));
+					Table.SetCell(2, CString::ToByteStr(it.second->BytesRead()));
+					Table.SetCell(3, CString::ToByteStr(it.second->BytesRead() + it.second->BytesWritten()));
+				}
+				PutTable(Table);
+			}
+		},
+		{
+			"Undo [n]",
+			"Reverts your last n configuration changes.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const unsigned int uCount = sArgs.Token(0).empty() ? 1 : sArgs.Token(0).ToUInt();
+				if (uCount == 0) {
+					PutUsage("Undo [n]");
+					return;
+				}
+				Undo(uCount);
+			}
+		},
+		{
+			"UnloadMod <module> [args]",
+			"Unloads a global module.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				OnUnloadModCommand(pZNC, sArgs);
+			}
+		},
+		{
+			"Unwatch <scope>",
+			"Removes a Watch subscription.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const CString sScope = sArgs.Token(0);
+				if (sScope.empty()) {
+					PutUsage("Unwatch <scope>");
+					return;
+				}
+				if (m_mWatches.find(sScope) == m_mWatches.end()) {
+					PutError("not watching '" + sScope + "'");
+					return;
+				}
+				SetWatch(sScope, "");
+				PutSuccess("stopped watching '" + sScope + "'");
+			}
+		},
+		{
+			"UpdateMod <module>",
+			"Reloads all instances of a module.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const CString sMod = sArgs.Token(0);
+				if (sMod.empty()) {
+					PutUsage("UpdateMod <module>");
+					return;
+				}
+
+				CModInfo Info;
+				CString sError;
+				if (!pZNC->GetModules().GetModInfo(Info, sMod, sError))
+					PutError(sError);
 				else if (!pZNC->UpdateModule(sMod))
 					PutError("module '" + sMod + "' not updated");
 				else
 					PutSuccess("module '" + sMod + "' updated");
 			}
 		},
+		{
+			"Watch [scope <variable|@user|@network|@client>[,...]]",
+			"Notifies about changes of matching (wildcards) variables and events, or lists subscriptions. Use - for global settings.",
+			[=](CZNC* pZNC, const CString& sArgs) {
+				const CString sScope = sArgs.Token(0);
+				const CString sItems = sArgs.Token(1, true).Replace_n(" ", "");
+
+				if (sScope.empty()) {
+					if (m_mWatches.empty()) {
+						PutLine("No subscriptions");
+						return;
+					}
+					CAdminTable Table(m_sArena, { "Scope", "Watching" });
+					for (const auto& it : m_mWatches) {
+						Table.AddRow();
+						Table.SetCell(0, it.first);
+						Table.SetCell(1, CString(",").Join(it.second.items.begin(), it.second.items.end()));
+					}
+					PutTable(Table);
+					return;
+				}
+
+				if (sItems.empty()) {
+					PutUsage("Watch <scope> <variable|@user|@network|@client>[,...]");
+					return;
+				}
+
+				SetWatch(sScope, sItems);
+				PutSuccess("watching '" + sScope + "'");
+			}
+		},
 	};
 
 	const std::vector<Command<CUser>> UserCmds = {
@@ -1529,10 +2916,52 @@ private:
 				}
 
 				CString sError;
-				if (pUser->AddNetwork(sNetwork, sError))
+				if (CIRCNetwork* pNetwork = pUser->AddNetwork(sNetwork, sError)) {
+					NotifyWatches(GetScope(pNetwork), "@network");
 					PutSuccess("network added. Use /znc Jump " + sNetwork + ", or connect to ZNC with username " + pUser->GetUserName() + "/" + sNetwork + " (instead of just " + pUser->GetUserName() + ") to connect to it.");
-				else
+				} else {
 					PutError(sError);
+				}
+			}
+		},
+		{
+			"AutoDetach [days|off]",
+			"Detaches channels the user has been idle in for the given number of days.",
+			[=](CUser* pUser, const CString& sArgs) {
+				CAdminMod* pMod = pUser == GetUser() ? this : dynamic_cast<CAdminMod*>(pUser->GetModules().FindModule(GetModName()));
+				if (!pMod) {
+					PutError("the " + GetModName() + " module is not loaded for '" + pUser->GetUserName() + "'");
+					return;
+				}
+
+				if (!sArgs.empty()) {
+					if (sArgs.Equals("off")) {
+						pMod->DelNV("autodetach");
+					} else if (sArgs.ToUInt() == 0 || sArgs.find_first_not_of("0123456789") != CString::npos) {
+						PutUsage("AutoDetach [days|off]");
+						return;
+					} else {
+						pMod->SetNV("autodetach", CString(sArgs.ToUInt()));
+					}
+				}
+
+				const CString sDays = pMod->GetNV("autodetach");
+				PutLine("AutoDetach = " + (sDays.empty() ? CString("off") : sDays + " days"));
+
+				CAdminTable Table(m_sArena, { "Channel", "Detached", "Lines", "Saved" });
+				unsigned long long uTotal = 0;
+				for (const auto& it : pMod->m_mAutoDetached) {
+					Table.AddRow();
+					Table.SetCell(0, it.first);
+					Table.SetCell(1, CUtils::FormatTime(it.second.since, "%Y-%m-%d %H:%M", GetUser()->GetTimezone()));
+					Table.SetCell(2, CString(it.second.lines));
+					Table.SetCell(3, CString::ToByteStr(it.second.bytes));
+					uTotal += it.second.bytes;
+				}
+				if (!Table.empty()) {
+					PutTable(Table);
+					PutLine(CString(pMod->m_mAutoDetached.size()) + " channels auto-detached, " + CString::ToByteStr(uTotal) + " not sent to clients");
+				}
 			}
 		},
 		{
@@ -1573,10 +3002,44 @@ private:
 					return;
 				}
 
-				if (pUser->DeleteNetwork(sNetwork))
+				const CIRCNetwork* pNetwork = pUser->FindNetwork(sNetwork);
+				const CString sScope = pNetwork ? GetScope(pNetwork) : CString();
+				if (pUser->DeleteNetwork(sNetwork)) {
+					NotifyWatches(sScope, "@network");
 					PutSuccess("network '" + sNetwork + "' deleted");
-				else
+				} else {
 					PutError("unknown network");
+				}
+			}
+		},
+		{
+			"Inherit [template|--none]",
+			"Shows or sets the template the user inherits variables from.",
+			[=](CUser* pUser, const CString& sArgs) {
+				const CString sTemplate = sArgs.Token(0);
+				if (sTemplate.empty()) {
+					auto it = m_Shared.inherits.find(pUser->GetUserName());
+					if (it == m_Shared.inherits.end())
+						PutLine("No template");
+					else
+						PutLine("Template = " + it->second);
+					return;
+				}
+
+				if (!GetUser()->IsAdmin()) {
+					PutError("access denied");
+					return;
+				}
+
+				if (sTemplate.Equals("--none")) {
+					SetInherit(pUser, "");
+					PutSuccess("no longer inheriting");
+				} else if (m_Shared.templates.find(sTemplate) == m_Shared.templates.end()) {
+					PutError("unknown template '" + sTemplate + "'");
+				} else {
+					SetInherit(pUser, sTemplate);
+					PutSuccess("inheriting template '" + sTemplate + "'");
+				}
 			}
 		},
 		{
@@ -1585,17 +3048,16 @@ private:
 			[=](CUser* pUser, const CString& sArgs) {
 				const CString sFilter = sArgs.Token(1);
 
-				CTable Table;
-				Table.AddColumn("Host");
-				Table.AddColumn("Name");
+				CAdminTable Table(m_sArena, { "Host", "Name" });
+				Table.Reserve(pUser->GetAllClients().size(), 48);
 
 				for (const CClient* pClient : pUser->GetAllClients()) {
 					if (sFilter.empty()
 							|| !pClient->GetRemoteIP().WildCmp(sFilter, CString::CaseInsensitive)
 							|| !pClient->GetFullName().WildCmp(sFilter, CString::CaseInsensitive)) {
 						Table.AddRow();
-						Table.SetCell("Host", pClient->GetRemoteIP());
-						Table.SetCell("Name", pClient->GetFullName());
+						Table.SetCell(0, pClient->GetRemoteIP());
+						Table.SetCell(1, pClient->GetFullName());
 					}
 				}
 
@@ -1622,18 +3084,17 @@ private:
 			[=](CUser* pUser, const CString& sArgs) {
 				const CString sFilter = sArgs.Token(0);
 
-				CTable Table;
-				Table.AddColumn("Network");
-				Table.AddColumn("Status");
+				CAdminTable Table(m_sArena, { "Network", "Status" });
+				Table.Reserve(pUser->GetNetworks().size(), 48);
 
 				for (const CIRCNetwork* pNetwork : pUser->GetNetworks()) {
 					if (sFilter.empty() || pNetwork->GetName().WildCmp(sFilter, CString::CaseInsensitive)) {
 						Table.AddRow();
-						Table.SetCell("Network", pNetwork->GetName());
+						Table.SetCell(0, pNetwork->GetName());
 						if (pNetwork->IsIRCConnected())
-							Table.SetCell("Status", "Online (" + pNetwork->GetCurrentServer()->GetName() + ")");
+							Table.SetCell(1, "Online (" + pNetwork->GetCurrentServer()->GetName() + ")");
 						else
-							Table.SetCell("Status", pNetwork->GetIRCConnectEnabled() ? "Offline" : "Disabled");
+							Table.SetCell(1, pNetwork->GetIRCConnectEnabled() ? "Offline" : "Disabled");
 					}
 				}
 
@@ -1661,21 +3122,28 @@ private:
 				OnReloadModCommand(pUser, sArgs);
 			}
 		},
+		{
+			"Search <pattern> [--limit <n>]",
+			"Searches the channel and query playback buffers of all networks.",
+			[=](CUser* pUser, const CString& sArgs) {
+				std::vector<std::pair<CString, const CBuffer*>> vBuffers;
+				for (const CIRCNetwork* pNetwork : pUser->GetNetworks())
+					AddNetworkBuffers(pNetwork, pNetwork->GetName() + "/", vBuffers);
+				SearchBuffers(vBuffers, sArgs);
+			}
+		},
 		{
 			"Traffic",
 			"Shows the amount of user specific traffic.",
 			[=](CUser* pUser, const CString& sArgs) {
-				CTable Table;
-				Table.AddColumn("Network");
-				Table.AddColumn("Sent");
-				Table.AddColumn("Received");
-				Table.AddColumn("Total");
+				CAdminTable Table(m_sArena, { "Network", "Sent", "Received", "Total" });
+				Table.Reserve(pUser->GetNetworks().size(), 48);
 				for (const CIRCNetwork* pNetwork : pUser->GetNetworks()) {
 					Table.AddRow();
-					Table.SetCell("Network", pNetwork->GetName());
-					Table.SetCell("Sent", CString::ToByteStr(pNetwork->BytesWritten()));
-					Table.SetCell("Received", CString::ToByteStr(pNetwork->BytesRead()));
-					Table.SetCell("Total", CString::ToByteStr(pNetwork->BytesRead() + pNetwork->BytesWritten()));
+					Table.SetCell(0, pNetwork->GetName());
+					Table.SetCell(1, CString::ToByteStr(pNetwork->BytesWritten()));
+					Table.SetCell(2, CString::ToByteStr(pNetwork->BytesRead()));
+					Table.SetCell(3, CString::ToByteStr(pNetwork->BytesRead() + pNetwork->BytesWritten()));
 				}
 				PutTable(Table);
 			}
@@ -1705,6 +3173,34 @@ private:
 					PutError("duplicate or invalid entry");
 			}
 		},
+		{
+			"AutoDetach [days|off|default]",
+			"Overrides the user's AutoDetach setting for the network.",
+			[=](CIRCNetwork* pNetwork, const CString& sArgs) {
+				CUser* pUser = pNetwork->GetUser();
+				CAdminMod* pMod = pUser == GetUser() ? this : dynamic_cast<CAdminMod*>(pUser->GetModules().FindModule(GetModName()));
+				if (!pMod) {
+					PutError("the " + GetModName() + " module is not loaded for '" + pUser->GetUserName() + "'");
+					return;
+				}
+
+				const CString sKey = "autodetach:" + pNetwork->GetName();
+				if (sArgs.Equals("default")) {
+					pMod->DelNV(sKey);
+				} else if (sArgs.Equals("off")) {
+					pMod->SetNV(sKey, "0");
+				} else if (!sArgs.empty()) {
+					if (sArgs.ToUInt() == 0 || sArgs.find_first_not_of("0123456789") != CString::npos) {
+						PutUsage("AutoDetach [days|off|default]");
+						return;
+					}
+					pMod->SetNV(sKey, CString(sArgs.ToUInt()));
+				}
+
+				const unsigned int uDays = pMod->GetAutoDetachDays(pNetwork);
+				PutLine("AutoDetach = " + (uDays ? CString(uDays) + " days" : CString("off")) + (pMod->GetNV(sKey).empty() ? " (default)" : ""));
+			}
+		},
 		{
 			"CloneNetwork <network> [user]",
 			"Clones all attributes from the specified network.",
@@ -1823,15 +3319,26 @@ private:
 			[=](CIRCNetwork* pNetwork, const CString& sArgs) {
 				const CString sFilter = sArgs.Token(0);
 
-				CTable Table;
-				Table.AddColumn("Channel");
-				Table.AddColumn("Status");
+				const std::vector<CChan*>& vChans = pNetwork->GetChans();
+				CAdminTable Table(m_sArena, { "Channel", "Status" });
+				Table.Reserve(vChans.size(), 32);
+
+				// the prefixes in the order of the server, instead of a
+				// GetPermStr() copy per channel
+				static const CString NoPerms;
+				const CIRCSock* pSock = pNetwork->GetIRCSock();
+				const CString& sPerms = pSock ? pSock->GetPerms() : NoPerms;
 
-				for (const CChan* pChan : pNetwork->GetChans()) {
+				for (const CChan* pChan : vChans) {
 					if (sFilter.empty() || pChan->GetName().WildCmp(sFilter, CString::CaseInsensitive)) {
 						Table.AddRow();
-						Table.SetCell("Channel", pChan->GetPermStr() + pChan->GetName());
-						Table.SetCell("Status", (pChan->IsOn() ? (pChan->IsDetached() ? "Detached" : "Joined") : (pChan->IsDisabled() ? "Disabled" : "Trying")));
+						Table.SetCell(0, "", 0);
+						for (const char& cPerm : sPerms) {
+							if (pChan->HasPerm(cPerm))
+								Table.AppendCell(0, &cPerm, 1);
+						}
+						Table.AppendCell(0, pChan->GetName());
+						Table.SetCell(1, pChan->IsOn() ? (pChan->IsDetached() ? "Detached" : "Joined") : (pChan->IsDisabled() ? "Disabled" : "Trying"));
 					}
 				}
 
@@ -1851,13 +3358,12 @@ private:
 			[=](CIRCNetwork* pNetwork, const CString& sArgs) {
 				const CString sFilter = sArgs.Token(0);
 
-				CTable Table;
-				Table.AddColumn("Server");
+				CAdminTable Table(m_sArena, { "Server" });
 
 				for (const CServer* pServer : pNetwork->GetServers()) {
 					if (sFilter.empty() || pServer->GetName().WildCmp(sFilter, CString::CaseInsensitive)) {
 						Table.AddRow();
-						Table.SetCell("Server", pServer->GetName() + ":" + (pServer->IsSSL() ? "+" : "") + CString(pServer->GetPort()) + (pServer == pNetwork->GetCurrentServer() ? " (current)" : ""));
+						Table.SetCell(0, pServer->GetName() + ":" + (pServer->IsSSL() ? "+" : "") + CString(pServer->GetPort()) + (pServer == pNetwork->GetCurrentServer() ? " (current)" : ""));
 					}
 				}
 
@@ -1885,18 +3391,24 @@ private:
 				OnReloadModCommand(pNetwork, sArgs);
 			}
 		},
+		{
+			"Search <pattern> [--limit <n>]",
+			"Searches the channel and query playback buffers of the network.",
+			[=](CIRCNetwork* pNetwork, const CString& sArgs) {
+				std::vector<std::pair<CString, const CBuffer*>> vBuffers;
+				AddNetworkBuffers(pNetwork, "", vBuffers);
+				SearchBuffers(vBuffers, sArgs);
+			}
+		},
 		{
 			"Traffic",
 			"Shows the amount of network specific traffic.",
 			[=](CIRCNetwork* pNetwork, const CString& sArgs) {
-				CTable Table;
-				Table.AddColumn("Sent");
-				Table.AddColumn("Received");
-				Table.AddColumn("Total");
+				CAdminTable Table(m_sArena, { "Sent", "Received", "Total" });
 				Table.AddRow();
-				Table.SetCell("Sent", CString::ToByteStr(pNetwork->BytesWritten()));
-				Table.SetCell("Received", CString::ToByteStr(pNetwork->BytesRead()));
-				Table.SetCell("Total", CString::ToByteStr(pNetwork->BytesRead() + pNetwork->BytesWritten()));
+				Table.SetCell(0, CString::ToByteStr(pNetwork->BytesWritten()));
+				Table.SetCell(1, CString::ToByteStr(pNetwork->BytesRead()));
+				Table.SetCell(2, CString::ToByteStr(pNetwork->BytesRead() + pNetwork->BytesWritten()));
 				PutTable(Table);
 			}
 		},
@@ -1910,555 +3422,4707 @@ private:
 	};
 
 	const std::vector<Command<CChan>> ChanCmds = {
+		{
+			"BufferStats",
+			"Shows the size of the channel playback buffer.",
+			[=](CChan* pChan, const CString& sArgs) {
+				const CBuffer& Buffer = pChan->GetBuffer();
+
+				size_t uBytes = 0;
+				for (size_t i = 0; i < Buffer.Size(); ++i) {
+					const CBufLine& Line = Buffer.GetBufLine(i);
+					uBytes += Line.GetFormat().size() + Line.GetText().size();
+				}
+
+				CAdminTable Table(m_sArena, { "Lines", "Bytes", "Oldest", "Newest" });
+				Table.AddRow();
+				Table.SetCell(0, CString(Buffer.Size()) + "/" + CString(pChan->GetBufferCount()));
+				Table.SetCell(1, CString::ToByteStr(uBytes));
+				if (!Buffer.IsEmpty()) {
+					const CString sTimezone = GetUser()->GetTimezone();
+					Table.SetCell(2, CUtils::FormatTime(Buffer.GetBufLine(0).GetTime().tv_sec, "%Y-%m-%d %H:%M:%S", sTimezone));
+					Table.SetCell(3, CUtils::FormatTime(Buffer.GetBufLine(Buffer.Size() - 1).GetTime().tv_sec, "%Y-%m-%d %H:%M:%S", sTimezone));
+				}
+				PutTable(Table);
+			}
+		},
+		{
+			"ClearBuffer",
+			"Clears the channel playback buffer.",
+			[=](CChan* pChan, const CString& sArgs) {
+				const size_t uLines = pChan->GetBuffer().Size();
+				pChan->ClearBuffer();
+				PutSuccess(CString(uLines) + " lines cleared");
+			}
+		},
+		{
+			"ExportBuffer <file>",
+			"Writes the channel playback buffer to a file.",
+			[=](CChan* pChan, const CString& sArgs) {
+				const CString sFile = sArgs.Token(0);
+				if (sFile.empty()) {
+					PutUsage("ExportBuffer <file>");
+					return;
+				}
+
+				const CString sPath = GetFilePath(sFile);
+				CFile File(sPath);
+				if (sPath.empty() || !File.Open(O_WRONLY | O_CREAT | O_TRUNC, 0600)) {
+					PutError("unable to open '" + sFile + "'");
+					return;
+				}
+
+				// streamed in chunks, the buffer itself is not copied
+				const CBuffer& Buffer = pChan->GetBuffer();
+				const CString sTimezone = GetUser()->GetTimezone();
+				CString sChunk;
+				for (size_t i = 0; i < Buffer.Size(); ++i) {
+					const CBufLine& Line = Buffer.GetBufLine(i);
+					sChunk += CUtils::FormatTime(Line.GetTime().tv_sec, "[%Y-%m-%d %H:%M:%S] ", sTimezone);
+					sChunk += Line.GetFormat().Replace_n("{text}", Line.GetText());
+					sChunk += "\n";
+					if (sChunk.size() >= 65536) {
+						File.Write(sChunk);
+						sChunk.clear();
+					}
+				}
+				File.Write(sChunk);
+				File.Close();
+
+				PutSuccess(CString(Buffer.Size()) + " lines written to '" + sPath + "'");
+			}
+		},
+		{
+			"Search <pattern> [--limit <n>]",
+			"Searches the channel playback buffer.",
+			[=](CChan* pChan, const CString& sArgs) {
+				SearchBuffers({std::make_pair(pChan->GetName(), &pChan->GetBuffer())}, sArgs);
+			}
+		},
+		{
+			"TrimBuffer <lines|age>",
+			"Keeps only the newest lines, or the lines newer than an age such as 12h or 7d.",
+			[=](CChan* pChan, const CString& sArgs) {
+				const CString sArg = sArgs.Token(0);
+				time_t tAge = 0;
+				const bool bAge = !sArg.empty() && !isdigit((unsigned char) sArg.back());
+				if (sArg.empty() || (bAge ? !ParseDuration(sArg, tAge) : sArg.find_first_not_of("0123456789") != CString::npos)) {
+					PutUsage("TrimBuffer <lines|age>");
+					return;
+				}
+
+				const CBuffer& Buffer = pChan->GetBuffer();
+				size_t uFirst = 0;
+				if (bAge) {
+					const time_t tLimit = time(nullptr) - tAge;
+					while (uFirst < Buffer.Size() && Buffer.GetBufLine(uFirst).GetTime().tv_sec < tLimit)
+						++uFirst;
+				} else if (sArg.ToUInt() < Buffer.Size()) {
+					uFirst = Buffer.Size() - sArg.ToUInt();
+				}
+
+				if (uFirst == 0) {
+					PutLine("Nothing to trim");
+					return;
+				}
+
+				// CChan has no API to drop old lines, so the rest is re-added
+				std::vector<CBufLine> vLines;
+				vLines.reserve(Buffer.Size() - uFirst);
+				for (size_t i = uFirst; i < Buffer.Size(); ++i)
+					vLines.push_back(Buffer.GetBufLine(i));
+
+				pChan->ClearBuffer();
+				for (const CBufLine& Line : vLines) {
+					const timeval tv = Line.GetTime();
+					pChan->AddBuffer(Line.GetFormat(), Line.GetText(), &tv, Line.GetTags());
+				}
+
+				PutSuccess(CString(uFirst) + " lines trimmed");
+			}
+		},
 	};
 };
 
 
-CString CAdminMod::GetInfix() const
-{
-	CString sInfix = GetNV("infix");
-	if (sInfix.empty())
-		sInfix = GetUser()->GetStatusPrefix();
-	return sInfix;
+bool CAdminMod::OnLoad(const CString& sArgs, CString& sMessage)
+{
+	LoadTemplates();
+	LoadAutoDetach();
+
+	AddTimer(new CAdminTimer(this, AutoDetachInterval, "autodetach", [this]() {
+		CheckAutoDetach();
+		return true;
+	}));
+
+	if (GetUser()->IsAdmin()) {
+		if (GetSharedNV("certwatch").ToBool())
+			WatchCert(true);
+
+		SampleListeners();
+		AddTimer(new CAdminTimer(this, ListenerInterval, "listeners", [this]() {
+			SampleListeners();
+			return true;
+		}));
+
+		if (GetSharedNV("persistbuffers").ToBool())
+			LoadBuffers();
+
+		for (MCString::iterator it = BeginNV(); it != EndNV(); ++it) {
+			if (it->first.StartsWith("watch:"))
+				it->second.Split(",", m_mWatches[it->first.Token(1, true, ":")].items, false);
+		}
+		if (!m_mWatches.empty())
+			CheckWatches(false);
+
+		CString sError;
+		if (GetNV("controlsocket").ToBool() && !OpenControl(sError))
+			DEBUG("admin: " << sError);
+
+		if (GetSharedNV("history").ToBool()) {
+			LoadHistory();
+			SampleHistory();
+		}
+	}
+
+	return true;
+}
+
+CAdminMod::~CAdminMod()
+{
+	SaveAutoDetach();
+	m_Shared.watchers.erase(this);
+	if (m_Shared.certWatcher == this) {
+		m_Shared.certWatcher = nullptr;
+		if (CAdminMod* pMod = FindOtherAdmin())
+			pMod->WatchCert(true);
+	}
+	if (m_Shared.buffers.owner == this) {
+		// another admin restores the rest from the same mapping, the file
+		// is kept for the next load otherwise
+		if (CAdminMod* pMod = FindOtherAdmin())
+			pMod->TakeBuffers();
+		else
+			UnloadBuffers();
+	}
+	CloseControl();
+	// the samples taken since the last save, once for all admins
+	if (m_Shared.historyTime != m_Shared.historySaved)
+		SaveHistory();
+
+	// written records are in the page cache and reach the disk without
+	// blocking the unload for an fsync()
+	if (m_iAuditFD >= 0)
+		close(m_iAuditFD);
+}
+
+CString CAdminMod::GetInfix() const
+{
+	CString sInfix = GetNV("infix");
+	if (sInfix.empty())
+		sInfix = GetUser()->GetStatusPrefix();
+	return sInfix;
+}
+
+void CAdminMod::SetInfix(const CString& sInfix)
+{
+	SetNV("infix", sInfix);
+}
+
+void CAdminMod::OnModCommand(const CString& sLine)
+{
+	CLatencyTimer Timer(m_Latency);
+	CAdminTable::ResetArena(m_sArena, TableArenaKeep);
+	const CString sCmd = sLine.Token(0);
+
+	m_sTarget = GetModName();
+
+	if (!GetUser()->IsAdmin() && !sCmd.Equals("Help") && !sCmd.Equals("Get") && !sCmd.Equals("List")) {
+		PutError("access denied.");
+		return;
+	}
+
+	if (sCmd.Equals("Help")) {
+		const CString sFilter = sLine.Token(1);
+
+		const CAdminTable Table = FilterCmdTable(GlobalCmds, sFilter);
+		if (!Table.empty())
+			PutTable(Table);
+		else if (!sFilter.empty())
+			PutModule("No matches for '" + sFilter + "'");
+
+		const CString sPfx = GetUser()->GetStatusPrefix() + GetInfix();
+
+		if (sFilter.empty()) {
+			PutModule("To access settings of the current user or network, open a query");
+			PutModule("with " + sPfx + "user or " + sPfx + "network, respectively.");
+			PutModule("-----");
+			PutModule("- user settings: /msg " + sPfx + "user help");
+			PutModule("- network settings: /msg " + sPfx + "network help");
+			PutModule("-----");
+			PutModule("To access settings of a different user (admins only) or a specific");
+			PutModule("network, open a query with " + sPfx + "target, where target is the name of");
+			PutModule("the user or network. The same applies to channel specific settings.");
+			PutModule("-----");
+			PutModule("- user settings: /msg " + sPfx + "somebody help");
+			PutModule("- network settings: /msg " + sPfx + "freenode help");
+			PutModule("- channel settings: /msg " + sPfx + "#znc help");
+			PutModule("-----");
+			PutModule("It is also possible to access the network settings of a different");
+			PutModule("user (admins only), or the channel settings of a different network.");
+			PutModule("Combine a user, network and channel name separated by a forward");
+			PutModule("slash ('/') character.");
+			PutModule("-----");
+			PutModule("Advanced examples:");
+			PutModule("- network settings of another user: /msg " + sPfx + "somebody/freenode help");
+			PutModule("- channel settings of another network: /msg " + sPfx + "freenode/#znc help");
+			PutModule("- channel settings of another network of another user: /msg " + sPfx + "somebody/freenode/#znc help");
+		}
+	} else if (sCmd.Equals("List")) {
+		OnListCommand(&CZNC::Get(), sLine, GlobalVars);
+	} else if (sCmd.Equals("Get")) {
+		OnGetCommand(&CZNC::Get(), sLine, GlobalVars);
+	} else if (sCmd.Equals("Set")) {
+		OnSetCommand(&CZNC::Get(), sLine, GlobalVars);
+	} else if (sCmd.Equals("Reset")) {
+		OnResetCommand(&CZNC::Get(), sLine, GlobalVars);
+	} else {
+		OnExecCommand(&CZNC::Get(), sLine, GlobalCmds);
+	}
+}
+
+CModule::EModRet CAdminMod::OnUserTextMessage(CTextMessage& Message)
+{
+	if (CIRCNetwork* pNetwork = Message.GetNetwork()) {
+		if (CChan* pChan = pNetwork->FindChan(Message.GetTarget()))
+			OnChanActivity(pChan, Message, true);
+	}
+	return CONTINUE;
+}
+
+CModule::EModRet CAdminMod::OnUserActionMessage(CActionMessage& Message)
+{
+	if (CIRCNetwork* pNetwork = Message.GetNetwork()) {
+		if (CChan* pChan = pNetwork->FindChan(Message.GetTarget()))
+			OnChanActivity(pChan, Message, true);
+	}
+	return CONTINUE;
+}
+
+CModule::EModRet CAdminMod::OnChanTextMessage(CTextMessage& Message)
+{
+	if (CChan* pChan = Message.GetChan()) {
+		OnChanActivity(pChan, Message, false);
+
+		// a mention brings an auto-detached channel back
+		if (IsMention(Message.GetText(), pChan->GetNetwork()->GetCurNick()) && m_mAutoDetached.erase(GetChanKey(pChan)))
+			pChan->AttachUser();
+	}
+	return CONTINUE;
+}
+
+CModule::EModRet CAdminMod::OnChanActionMessage(CActionMessage& Message)
+{
+	if (CChan* pChan = Message.GetChan()) {
+		OnChanActivity(pChan, Message, false);
+
+		if (IsMention(Message.GetText(), pChan->GetNetwork()->GetCurNick()) && m_mAutoDetached.erase(GetChanKey(pChan)))
+			pChan->AttachUser();
+	}
+	return CONTINUE;
+}
+
+CModule::EModRet CAdminMod::OnChanNoticeMessage(CNoticeMessage& Message)
+{
+	if (CChan* pChan = Message.GetChan())
+		OnChanActivity(pChan, Message, false);
+	return CONTINUE;
+}
+
+bool CAdminMod::OnBoot()
+{
+	// all users have been loaded and no client is accepted yet
+	RestoreBuffers(true);
+	return true;
+}
+
+void CAdminMod::OnClientLogin()
+{
+	// the counts are read when the Watch queue is processed
+	NotifyWatches(GetScope(GetUser()), "@client");
+	if (const CClient* pClient = GetClient()) {
+		if (pClient->GetNetwork())
+			NotifyWatches(GetScope(pClient->GetNetwork()), "@client");
+	}
+}
+
+void CAdminMod::OnClientDisconnect()
+{
+	NotifyWatches(GetScope(GetUser()), "@client");
+	if (const CClient* pClient = GetClient()) {
+		if (pClient->GetNetwork())
+			NotifyWatches(GetScope(pClient->GetNetwork()), "@client");
+	}
+}
+
+void CAdminMod::OnIRCConnected()
+{
+	NotifyWatches(GetScope(GetNetwork()), "@network");
+}
+
+void CAdminMod::OnIRCDisconnected()
+{
+	NotifyWatches(GetScope(GetNetwork()), "@network");
+}
+
+CModule::EModRet CAdminMod::OnUserRaw(CString& sLine)
+{
+	CString sCopy = sLine;
+	if (sCopy.StartsWith("@"))
+		sCopy = sCopy.Token(1, true);
+	if (sCopy.StartsWith(":"))
+		sCopy = sCopy.Token(1, true);
+
+	const CString sCmd = sCopy.Token(0);
+
+	if (sCmd.Equals("ZNC") || sCmd.Equals("PRIVMSG")) {
+		CString sTarget = sCopy.Token(1);
+		if (sTarget.TrimPrefix(GetUser()->GetStatusPrefix() + GetInfix())) {
+			const CString sRest = sCopy.Token(2, true).TrimPrefix_n(":");
+			const CString sPfx = GetInfix();
+
+			m_sTarget = GetInfix() + sTarget;
+
+			return OnTargetCommand(sTarget, sRest);
+		}
+	}
+	return CONTINUE;
+}
+
+CModule::EModRet CAdminMod::OnTargetCommand(const CString& sTarget, const CString& sRest)
+{
+	CLatencyTimer Timer(m_Latency);
+	CAdminTable::ResetArena(m_sArena, TableArenaKeep);
+
+	// <[[user/]network/]#chan*>
+	if (sTarget.find_first_of("*?") != CString::npos)
+		return OnWildChanCommand(sTarget, sRest);
+
+	// <user>
+	if (sTarget.Equals("user"))
+		return OnUserCommand(GetUser(), sRest);
+	if (CUser* pUser = CZNC::Get().FindUser(sTarget))
+		return OnUserCommand(pUser, sRest);
+
+	// <network>
+	if (sTarget.Equals("network") && GetNetwork())
+		return OnNetworkCommand(GetNetwork(), sRest);
+	if (CIRCNetwork* pNetwork = GetUser()->FindNetwork(sTarget))
+		return OnNetworkCommand(pNetwork, sRest);
+
+	// <#chan>
+	if (CChan* pChan = GetNetwork() ? GetNetwork()->FindChan(sTarget) : nullptr)
+		return OnChanCommand(pChan, sRest);
+
+	VCString vsParts;
+	sTarget.Split("/", vsParts, false);
+	if (vsParts.size() == 2) {
+		// <user/network>
+		if (CUser* pUser = CZNC::Get().FindUser(vsParts[0])) {
+			if (CIRCNetwork* pNetwork = pUser->FindNetwork(vsParts[1])) {
+				return OnNetworkCommand(pNetwork, sRest);
+			} else {
+				// <user/#chan>
+				if (pUser == GetUser()) {
+					if (CIRCNetwork* pUserNetwork = GetNetwork()) {
+						if (CChan* pChan = pUserNetwork->FindChan(vsParts[1]))
+							return OnChanCommand(pChan, sRest);
+					}
+				}
+				if (pUser->GetNetworks().size() == 1) {
+					if (CIRCNetwork* pFirstNetwork = pUser->GetNetworks().front()) {
+						if (CChan* pChan = pFirstNetwork->FindChan(vsParts[1]))
+							return OnChanCommand(pChan, sRest);
+					}
+				}
+			}
+			PutError("unknown (or ambiguous) network or channel");
+			return HALT;
+		}
+		// <network/#chan>
+		if (CIRCNetwork* pNetwork = GetUser()->FindNetwork(vsParts[0])) {
+			if (CChan* pChan = pNetwork->FindChan(vsParts[1])) {
+				return OnChanCommand(pChan, sRest);
+			} else {
+				PutError("unknown channel");
+				return HALT;
+			}
+		}
+	} else if (vsParts.size() == 3) {
+		// <user/network/#chan>
+		if (CUser* pUser = CZNC::Get().FindUser(vsParts[0])) {
+			if (CIRCNetwork* pNetwork = pUser->FindNetwork(vsParts[1])) {
+				if (CChan* pChan = pNetwork->FindChan(vsParts[2])) {
+					return OnChanCommand(pChan, sRest);
+				} else {
+					PutError("unknown channel");
+					return HALT;
+				}
+			} else {
+				PutError("unknown network");
+				return HALT;
+			}
+		}
+	}
+	return CONTINUE;
+}
+
+CModule::EModRet CAdminMod::OnWildChanCommand(const CString& sTarget, const CString& sRest)
+{
+	VCString vsParts;
+	sTarget.Split("/", vsParts, false);
+
+	CIRCNetwork* pNetwork = nullptr;
+	if (vsParts.size() == 1) {
+		pNetwork = GetNetwork();
+	} else if (vsParts.size() == 2) {
+		pNetwork = GetUser()->FindNetwork(vsParts[0]);
+	} else if (vsParts.size() == 3) {
+		if (CUser* pUser = CZNC::Get().FindUser(vsParts[0]))
+			pNetwork = pUser->FindNetwork(vsParts[1]);
+	}
+
+	if (!pNetwork) {
+		PutError("unknown network");
+		return HALT;
+	}
+
+	if (pNetwork->GetUser() != GetUser() && !GetUser()->IsAdmin()) {
+		PutError("access denied");
+		return HALT;
+	}
+
+	std::vector<CChan*> vChans;
+	for (CChan* pChan : pNetwork->GetChans()) {
+		if (pChan->GetName().WildCmp(vsParts.back(), CString::CaseInsensitive))
+			vChans.push_back(pChan);
+	}
+
+	if (vChans.empty())
+		PutError("no matching channels");
+	else
+		OnBulkChanCommand(vChans, sRest);
+
+	return HALT;
+}
+
+void CAdminMod::OnBulkChanCommand(const std::vector<CChan*>& vChans, const CString& sLine)
+{
+	const CString sCmd = sLine.Token(0);
+	const CString sVar = sLine.Token(1);
+	const CString sVal = sLine.Token(2, true);
+
+	if (sCmd.Equals("Help")) {
+		OnHelpCommand(sLine, ChanCmds);
+	} else if (sCmd.Equals("List")) {
+		OnListCommand(vChans.front(), sLine, ChanVars);
+	} else if (sCmd.Equals("Get")) {
+		if (sVar.empty()) {
+			PutUsage("Get <variable>");
+			return;
+		}
+		bool bFound = false;
+		for (const CChan* pChan : vChans) {
+			for (const auto& Var : ChanVars) {
+				if (Var.name.WildCmp(sVar, CString::CaseInsensitive)) {
+					PutLine(pChan->GetName() + ": " + Var.name + " = " + Var.get(pChan).Replace_n("\n", ", "));
+					bFound = true;
+				}
+			}
+		}
+		if (!bFound)
+			PutError("unknown variable");
+	} else if (sCmd.Equals("Set") || sCmd.Equals("Reset")) {
+		const bool bReset = sCmd.Equals("Reset");
+		if (sVar.empty() || (!bReset && sVal.empty())) {
+			PutUsage(bReset ? "Reset <variable>" : "Set <variable> <value>");
+			return;
+		}
+
+		// one summary instead of a line per channel, and one
+		// JOIN round for all channels that got enabled
+		unsigned int uChanged = 0;
+		unsigned int uFailed = 0;
+		bool bFound = false;
+		bool bEnabled = false;
+		for (CChan* pChan : vChans) {
+			for (const auto& Var : ChanVars) {
+				if (!Var.name.WildCmp(sVar, CString::CaseInsensitive))
+					continue;
+				bFound = true;
+
+				const bool bWasDisabled = pChan->IsDisabled();
+				const CString sOld = Var.get(pChan);
+				const bool bOk = bReset ? (Var.reset && Var.reset(pChan)) : Var.set(pChan, sVal);
+				if (bOk) {
+					OnVarChanged(pChan, Var.name, bReset);
+					Audit(bReset ? AuditReset : AuditSet, GetScope(pChan), Var.name, sOld, Var.get(pChan));
+					NotifyWatches(GetScope(pChan), Var.name);
+					JournalValue(GetScope(pChan), Var.name, sOld);
+					bEnabled |= bWasDisabled && !pChan->IsDisabled();
+					++uChanged;
+				} else {
+					++uFailed;
+				}
+			}
+		}
+
+		CommitUndo(GetScope(vChans.front()->GetNetwork()) + "/" + CString(vChans.size()) + " channels: " + sLine);
+
+		if (!bFound) {
+			PutError("unknown variable");
+			return;
+		}
+
+		if (bEnabled)
+			vChans.front()->GetNetwork()->JoinChans();
+
+		const CString sSummary = sCmd + " " + sVar + " on " + CString(uChanged) + " of " + CString(vChans.size()) + " channels";
+		if (uFailed)
+			PutError(sSummary + " (" + CString(uFailed) + " failed)");
+		else
+			PutSuccess(sSummary);
+	} else {
+		for (CChan* pChan : vChans) {
+			PutLine(pChan->GetName() + ":");
+			OnExecCommand(pChan, sLine, ChanCmds);
+		}
+	}
+}
+
+CModule::EModRet CAdminMod::OnUserCommand(CUser* pUser, const CString& sLine)
+{
+	const CString sCmd = sLine.Token(0);
+
+	if (pUser != GetUser() && !GetUser()->IsAdmin()) {
+		PutError("access denied");
+		return HALT;
+	}
+
+	if (sCmd.Equals("Help"))
+		OnHelpCommand(sLine, UserCmds);
+	else if (sCmd.Equals("List"))
+		OnListCommand(pUser, sLine, UserVars);
+	else if (sCmd.Equals("Get"))
+		OnGetCommand(pUser, sLine, UserVars);
+	else if (sCmd.Equals("Set"))
+		OnSetCommand(pUser, sLine, UserVars);
+	else if (sCmd.Equals("Reset"))
+		OnResetCommand(pUser, sLine, UserVars);
+	else
+		OnExecCommand(pUser, sLine, UserCmds);
+
+	return HALT;
+}
+
+CModule::EModRet CAdminMod::OnNetworkCommand(CIRCNetwork* pNetwork, const CString& sLine)
+{
+	const CString sCmd = sLine.Token(0);
+
+	if (pNetwork->GetUser() != GetUser() && !GetUser()->IsAdmin()) {
+		PutError("access denied");
+		return HALT;
+	}
+
+	if (sCmd.Equals("Help"))
+		OnHelpCommand(sLine, NetworkCmds);
+	else if (sCmd.Equals("List"))
+		OnListCommand(pNetwork, sLine, NetworkVars);
+	else if (sCmd.Equals("Get"))
+		OnGetCommand(pNetwork, sLine, NetworkVars);
+	else if (sCmd.Equals("Set"))
+		OnSetCommand(pNetwork, sLine, NetworkVars);
+	else if (sCmd.Equals("Reset"))
+		OnResetCommand(pNetwork, sLine, NetworkVars);
+	else
+		OnExecCommand(pNetwork, sLine, NetworkCmds);
+
+	return HALT;
+}
+
+CModule::EModRet CAdminMod::OnChanCommand(CChan* pChan, const CString& sLine)
+{
+	const CString sCmd = sLine.Token(0);
+
+	if (pChan->GetNetwork()->GetUser() != GetUser() && !GetUser()->IsAdmin()) {
+		PutError("access denied");
+		return HALT;
+	}
+
+	if (sCmd.Equals("Help"))
+		OnHelpCommand(sLine, ChanCmds);
+	else if (sCmd.Equals("List"))
+		OnListCommand(pChan, sLine, ChanVars);
+	else if (sCmd.Equals("Get"))
+		OnGetCommand(pChan, sLine, ChanVars);
+	else if (sCmd.Equals("Set"))
+		OnSetCommand(pChan, sLine, ChanVars);
+	else if (sCmd.Equals("Reset"))
+		OnResetCommand(pChan, sLine, ChanVars);
+	else
+		OnExecCommand(pChan, sLine, ChanCmds);
+
+	return HALT;
+}
+
+template <typename C>
+void CAdminMod::OnHelpCommand(const CString& sLine, const std::vector<C>& vCmds)
+{
+	const CString sFilter = sLine.Token(1);
+
+	const CAdminTable Table = FilterCmdTable(vCmds, sFilter);
+	if (!Table.empty())
+		PutTable(Table);
+	else
+		PutLine("No matches for '" + sFilter + "'");
+}
+
+template <typename T, typename V>
+void CAdminMod::OnListCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars)
+{
+	const CString sFilter = sLine.Token(1);
+
+	const CAdminTable Table = FilterVarTable(vVars, sFilter);
+	if (!Table.empty())
+		PutTable(Table);
+	else
+		PutError("unknown variable");
+}
+
+template <typename T, typename V>
+void CAdminMod::OnGetCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars)
+{
+	const CString sVar = sLine.Token(1);
+
+	if (sVar.empty()) {
+		PutUsage("Get <variable>");
+		return;
+	}
+
+	bool bFound = false;
+	for (const auto& Var : vVars) {
+		if (Var.name.WildCmp(sVar, CString::CaseInsensitive)) {
+			const CString sOrigin = GetVarOrigin(pObject, Var.name);
+			VCString vsValues;
+			Var.get(pObject).Split("\n", vsValues, false);
+			if (vsValues.empty()) {
+				PutLine(Var.name + " = " + sOrigin);
+			} else {
+				for (const CString& s : vsValues)
+					PutLine(Var.name + " = " + s + (sOrigin.empty() ? "" : " " + sOrigin));
+			}
+			bFound = true;
+		}
+	}
+
+	if (!bFound)
+		PutError("unknown variable");
+}
+
+template <typename T, typename V>
+void CAdminMod::OnSetCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars)
+{
+	const CString sVar = sLine.Token(1);
+	const CString sVal = sLine.Token(2, true);
+
+	if (sVar.empty() || sVal.empty()) {
+		PutUsage("Set <variable> <value>");
+		return;
+	}
+
+	bool bFound = false;
+	for (const auto& Var : vVars) {
+		if (Var.name.WildCmp(sVar, CString::CaseInsensitive)) {
+			const CString sOld = Var.get(pObject);
+			if (Var.set(pObject, sVal)) {
+				OnVarChanged(pObject, Var.name, false);
+				Audit(AuditSet, GetScope(pObject), Var.name, sOld, Var.get(pObject));
+				NotifyWatches(GetScope(pObject), Var.name);
+				JournalValue(GetScope(pObject), Var.name, sOld);
+				VCString vsValues;
+				Var.get(pObject).Split("\n", vsValues, false);
+				if (vsValues.empty()) {
+					PutLine(Var.name + " = ");
+				} else {
+					for (const CString& s : vsValues)
+						PutLine(Var.name + " = " + s);
+				}
+			}
+			bFound = true;
+		}
+	}
+
+	CommitUndo(GetScope(pObject) + ": " + sLine);
+
+	if (!bFound)
+		PutError("unknown variable");
+}
+
+template <typename T, typename V>
+void CAdminMod::OnResetCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars)
+{
+	const CString sVar = sLine.Token(1);
+
+	if (sVar.empty()) {
+		PutUsage("Reset <variable>");
+		return;
+	}
+
+	bool bFound = false;
+	for (const auto& Var : vVars) {
+		if (Var.name.WildCmp(sVar, CString::CaseInsensitive)) {
+			const CString sOld = Var.get(pObject);
+			if (!Var.reset) {
+				PutError("reset not supported");
+			} else if (Var.reset(pObject)) {
+				OnVarChanged(pObject, Var.name, true);
+				Audit(AuditReset, GetScope(pObject), Var.name, sOld, Var.get(pObject));
+				NotifyWatches(GetScope(pObject), Var.name);
+				JournalValue(GetScope(pObject), Var.name, sOld);
+				VCString vsValues;
+				Var.get(pObject).Split("\n", vsValues, false);
+				if (vsValues.empty()) {
+					PutLine(Var.name + " = ");
+				} else {
+					for (const CString& s : vsValues)
+						PutLine(Var.name + " = " + s);
+				}
+			}
+			bFound = true;
+		}
+	}
+
+	CommitUndo(GetScope(pObject) + ": " + sLine);
+
+	if (!bFound)
+		PutError("unknown variable");
+}
+
+template <typename T, typename C>
+void CAdminMod::OnExecCommand(T* pObject, const CString& sLine, const std::vector<C>& vCmds)
+{
+	const CString sCmd = sLine.Token(0);
+	const CString sArgs = sLine.Token(1, true);
+
+	for (const auto& Cmd : vCmds) {
+		if (Cmd.syntax.Token(0).Equals(sCmd)) {
+			const CString sName = Cmd.syntax.Token(0);
+			const CString sScope = GetScope(pObject);
+			const bool bAudit = IsMutating(sName);
+			// Restart and Shutdown do not return, they are logged before
+			// running, everything else with its outcome
+			const bool bFinal = sName.Equals("Restart") || sName.Equals("Shutdown");
+			if (bAudit && bFinal)
+				Audit(AuditCommand, sScope, sName, "", MaskSecretArgs(sName, sArgs));
+			const unsigned int uErrors = m_uErrors;
+			JournalCommand(sScope, sName, sArgs, [&]() {
+				Cmd.exec(pObject, sArgs);
+			});
+			if (bAudit && !bFinal)
+				Audit(AuditCommand, sScope, sName, m_uErrors == uErrors ? "ok" : "failed", MaskSecretArgs(sName, sArgs));
+			return;
+		}
+	}
+
+	PutError("unknown command");
+}
+
+template <typename T>
+void CAdminMod::OnListModsCommand(T* pObject, const CString& sArgs, CModInfo::EModuleType eType)
+{
+	const CString sFilter = sArgs.Token(0);
+
+	std::set<CModInfo> sMods;
+	pObject->GetModules().GetAvailableMods(sMods, eType);
+
+	CAdminTable Table(m_sArena, { "Module", "Description" });
+	Table.Reserve(sMods.size(), 96);
+
+	for (const CModInfo& Info : sMods) {
+		const CString& sName = Info.GetName();
+		if (sFilter.empty() || sName.StartsWith(sFilter) || sName.WildCmp(sFilter, CString::CaseInsensitive)) {
+			Table.AddRow();
+			if (pObject->GetModules().FindModule(sName))
+				Table.SetCell(0, sName + " (loaded)");
+			else
+				Table.SetCell(0, sName);
+			Table.SetCell(1, Info.GetDescription().Ellipsize(128));
+		}
+	}
+
+	if (Table.empty())
+		PutError("no matches for '" + sFilter + "'");
+	else
+		PutTable(Table);
+}
+
+template <typename T>
+void CAdminMod::OnLoadModCommand(T* pObject, const CString& sArgs, CModInfo::EModuleType eType)
+{
+	if (!GetUser()->IsAdmin() && GetUser()->DenyLoadMod()) {
+		PutError("access deniend");
+		return;
+	}
+
+	const CString sMod = sArgs.Token(0);
+	if (sMod.empty()) {
+		PutUsage("LoadMod <module> [args]");
+		return;
+	}
+
+	CModInfo Info;
+	CString sError;
+	if (!pObject->GetModules().GetModInfo(Info, sMod, sError))
+		PutError(sError);
+	else if (!pObject->GetModules().LoadModule(sMod, sArgs.Token(1, true), eType, nullptr, nullptr, sError))
+		PutError(sError);
+	else
+		PutSuccess("module '" + sMod + "' loaded");
+}
+
+template <typename T>
+void CAdminMod::OnReloadModCommand(T* pObject, const CString& sArgs)
+{
+	if (!GetUser()->IsAdmin() && GetUser()->DenyLoadMod()) {
+		PutError("access deniend");
+		return;
+	}
+
+	const CString sMod = sArgs.Token(0);
+	if (sMod.empty()) {
+		PutUsage("ReloadMod <module> [args]");
+		return;
+	}
+
+	CModInfo Info;
+	CString sError;
+	if (!pObject->GetModules().GetModInfo(Info, sMod, sError))
+		PutError(sError);
+	else if (!pObject->GetModules().ReloadModule(sMod, sArgs.Token(1, true), nullptr, nullptr, sError))
+		PutError(sError);
+	else
+		PutSuccess("module '" + sMod + "' reloaded");
+}
+
+template <typename T>
+void CAdminMod::OnUnloadModCommand(T* pObject, const CString& sArgs)
+{
+	if (!GetUser()->IsAdmin() && GetUser()->DenyLoadMod()) {
+		PutError("access deniend");
+		return;
+	}
+
+	const CString sMod = sArgs.Token(0);
+	if (sMod.empty()) {
+		PutUsage("UnloadMod <module> [args]");
+		return;
+	}
+
+	CModInfo Info;
+	CString sError;
+	if (!pObject->GetModules().GetModInfo(Info, sMod, sError))
+		PutError(sError);
+	else if (!pObject->GetModules().UnloadModule(sMod, sError))
+		PutError(sError);
+	else
+		PutSuccess("module '" + sMod + "' unloaded");
+}
+
+template <typename C>
+CAdminTable CAdminMod::FilterCmdTable(const std::vector<C>& vCmds, const CString& sFilter) const
+{
+	static const CString BuiltinCmds[][3] = {
+		{ "Get", "Get <variable>", "Gets the value of a variable." },
+		{ "Help", "Help [filter]", "Generates this output." },
+		{ "List", "List [filter]", "Lists available variables filtered by name or type." },
+		{ "Reset", "Reset <variable>", "Resets the value of a variable." },
+		{ "Set", "Set <variable> <value>", "Sets the value of a variable." },
+	};
+
+	// (syntax, description) pointing into the tables, sorted by syntax
+	std::vector<std::pair<const CString*, const CString*>> vMatches;
+	vMatches.reserve(vCmds.size() + 5);
+
+	for (const auto& Builtin : BuiltinCmds) {
+		if (sFilter.empty() || Builtin[0].WildCmp(sFilter, CString::CaseInsensitive))
+			vMatches.emplace_back(&Builtin[1], &Builtin[2]);
+	}
+
+	for (const auto& Cmd : vCmds) {
+		const CString sCmd =  Cmd.syntax.Token(0);
+		if (sFilter.empty() || sCmd.StartsWith(sFilter) || sCmd.WildCmp(sFilter, CString::CaseInsensitive))
+			vMatches.emplace_back(&Cmd.syntax, &Cmd.description);
+	}
+
+	// a command with the syntax of a built-in one replaces it, the stable
+	// sort keeps it after the built-in
+	std::stable_sort(vMatches.begin(), vMatches.end(), [](const std::pair<const CString*, const CString*>& a, const std::pair<const CString*, const CString*>& b) {
+		return *a.first < *b.first;
+	});
+	for (size_t i = 0; i + 1 < vMatches.size();) {
+		if (*vMatches[i].first == *vMatches[i + 1].first)
+			vMatches.erase(vMatches.begin() + i);
+		else
+			++i;
+	}
+
+	CAdminTable Table(m_sArena, { "Command", "Description" });
+	Table.Reserve(vMatches.size(), 96);
+
+	for (const auto& Match : vMatches) {
+		Table.AddRow();
+		Table.SetCell(0, *Match.first);
+		Table.SetCell(1, *Match.second);
+	}
+
+	return Table;
+}
+
+template <typename V>
+CAdminTable CAdminMod::FilterVarTable(const std::vector<V>& vVars, const CString& sFilter) const
+{
+	CAdminTable Table(m_sArena, { "Variable", "Description" });
+	Table.Reserve(vVars.size(), 96);
+
+	for (const auto& Var : vVars) {
+		const char* szType = VarTypes[Var.type];
+		if (sFilter.empty() || strcasecmp(szType, sFilter.c_str()) == 0 || Var.name.StartsWith(sFilter) || Var.name.WildCmp(sFilter, CString::CaseInsensitive)) {
+			Table.AddRow();
+			Table.SetCell(0, Var.name);
+			Table.AppendCell(0, " (");
+			Table.AppendCell(0, szType);
+			Table.AppendCell(0, ")");
+			Table.SetCell(1, Var.description);
+		}
+	}
+
+	return Table;
+}
+
+void CAdminMod::CollectConfig(const ConfigVisitor& Visitor) const
+{
+	CollectGlobalConfig(Visitor);
+	for (const auto& it : CZNC::Get().GetUserMap())
+		CollectUserConfig(it.second, Visitor);
+}
+
+void CAdminMod::CollectGlobalConfig(const ConfigVisitor& Visitor) const
+{
+	CZNC& ZNC = CZNC::Get();
+
+	CollectVars(&ZNC, "", GlobalVars, Visitor);
+
+	VCString vsPorts;
+	for (const CListener* pListener : ZNC.GetListeners())
+		vsPorts.push_back(GetListenerString(pListener));
+	Visitor("", "@ports", CString("\n").Join(vsPorts.begin(), vsPorts.end()));
+
+	Visitor("", "@modules", GetModulesString(ZNC.GetModules()));
+}
+
+void CAdminMod::CollectUserConfig(const CUser* pUser, const ConfigVisitor& Visitor) const
+{
+	const CString sUser = pUser->GetUserName();
+
+	Visitor(sUser, "@pass", GetPassString(pUser));
+	CollectVars(pUser, sUser, UserVars, Visitor);
+	Visitor(sUser, "@modules", GetModulesString(pUser->GetModules()));
+
+	for (const CIRCNetwork* pNetwork : pUser->GetNetworks()) {
+		const CString sNetwork = sUser + "/" + pNetwork->GetName();
+
+		CollectVars(pNetwork, sNetwork, NetworkVars, Visitor);
+
+		VCString vsServers;
+		for (const CServer* pServer : pNetwork->GetServers())
+			vsServers.push_back(pServer->GetString());
+		Visitor(sNetwork, "@servers", CString("\n").Join(vsServers.begin(), vsServers.end()));
+
+		Visitor(sNetwork, "@modules", GetModulesString(pNetwork->GetModules()));
+
+		for (const CChan* pChan : pNetwork->GetChans())
+			CollectVars(pChan, sNetwork + "/" + pChan->GetName(), ChanVars, Visitor);
+	}
+}
+
+template <typename T, typename V>
+void CAdminMod::CollectVars(const T* pObject, const CString& sScope, const std::vector<V>& vVars, const ConfigVisitor& Visitor) const
+{
+	for (const auto& Var : vVars) {
+		// the password is collected as a hash (@pass) and the
+		// infix is a setting of this module, not of the user
+		if (Var.name.Equals("Password") || Var.name.Equals("AdminInfix"))
+			continue;
+		Visitor(sScope, Var.name, Var.get(pObject));
+	}
+}
+
+CAdminMod::ApplyResult CAdminMod::ApplyConfig(const CString& sScope, const CString& sVar, const CString& sVal, bool bCreate, CString& sError)
+{
+	CZNC& ZNC = CZNC::Get();
+
+	const CString sUser = sScope.Token(0, false, "/");
+	const CString sNetwork = sScope.Token(1, false, "/");
+	const CString sChan = sScope.Token(2, true, "/");
+
+	// variables are notified by ApplyVar()
+	auto fnNotify = [this](const CString& sWatchScope, const CString& sItem, ApplyResult eResult) {
+		if (eResult == ApplyChanged)
+			NotifyWatches(sWatchScope, sItem);
+		return eResult;
+	};
+
+	if (sUser.empty()) {
+		if (sVar.Equals("@ports"))
+			return fnNotify("", "@ports", ApplyPorts(sVal, sError));
+		if (sVar.Equals("@modules"))
+			return fnNotify("", "@modules", ApplyModules(ZNC.GetModules(), CModInfo::GlobalModule, nullptr, nullptr, sVal, sError));
+		return ApplyVar(&ZNC, GlobalVars, sVar, sVal, sError);
+	}
+
+	CUser* pUser = ZNC.FindUser(sUser);
+	if (!pUser) {
+		if (!bCreate) {
+			sError = "unknown user '" + sUser + "'";
+			return ApplyFailed;
+		}
+		pUser = new CUser(sUser);
+		// a user cannot be added without a password, start with
+		// an unguessable one until the real hash (@pass) is applied
+		const CString sSalt = CUtils::GetSalt();
+		pUser->SetPass(CUser::SaltedHash(CUtils::GetSalt(), sSalt), CUser::HASH_DEFAULT, sSalt);
+		if (sVar.Equals("@pass") && sNetwork.empty())
+			SetPassString(pUser, sVal);
+		if (!ZNC.AddUser(pUser, sError)) {
+			delete pUser;
+			return ApplyFailed;
+		}
+		NotifyWatches(GetScope(pUser), "@user");
+	}
+
+	if (sNetwork.empty()) {
+		if (sVar.Equals("@pass")) {
+			if (GetPassString(pUser) == sVal)
+				return ApplyUnchanged;
+			if (!SetPassString(pUser, sVal)) {
+				sError = "invalid password hash for '" + sUser + "'";
+				return ApplyFailed;
+			}
+			return fnNotify(GetScope(pUser), "@pass", ApplyChanged);
+		}
+		if (sVar.Equals("@modules"))
+			return fnNotify(GetScope(pUser), "@modules", ApplyModules(pUser->GetModules(), CModInfo::UserModule, pUser, nullptr, sVal, sError));
+		return ApplyVar(pUser, UserVars, sVar, sVal, sError);
+	}
+
+	CIRCNetwork* pNetwork = pUser->FindNetwork(sNetwork);
+	if (!pNetwork) {
+		if (!bCreate) {
+			sError = "unknown network '" + sUser + "/" + sNetwork + "'";
+			return ApplyFailed;
+		}
+		pNetwork = pUser->AddNetwork(sNetwork, sError);
+		if (!pNetwork)
+			return ApplyFailed;
+		NotifyWatches(GetScope(pNetwork), "@network");
+	}
+
+	if (sChan.empty()) {
+		if (sVar.Equals("@servers"))
+			return fnNotify(GetScope(pNetwork), "@servers", ApplyServers(pNetwork, sVal));
+		if (sVar.Equals("@modules"))
+			return fnNotify(GetScope(pNetwork), "@modules", ApplyModules(pNetwork->GetModules(), CModInfo::NetworkModule, pUser, pNetwork, sVal, sError));
+		return ApplyVar(pNetwork, NetworkVars, sVar, sVal, sError);
+	}
+
+	CChan* pChan = pNetwork->FindChan(sChan);
+	if (!pChan) {
+		if (!bCreate || !pNetwork->AddChan(sChan, true)) {
+			sError = "unknown channel '" + sScope + "'";
+			return ApplyFailed;
+		}
+		pChan = pNetwork->FindChan(sChan);
+	}
+
+	return ApplyVar(pChan, ChanVars, sVar, sVal, sError);
+}
+
+template <typename T, typename V>
+CAdminMod::ApplyResult CAdminMod::ApplyVar(T* pObject, const std::vector<V>& vVars, const CString& sVar, const CString& sVal, CString& sError)
+{
+	for (const auto& Var : vVars) {
+		if (!Var.name.Equals(sVar))
+			continue;
+
+		if (Var.get(pObject) == sVal)
+			return ApplyUnchanged;
+
+		bool bReset = sVal.empty() || sVal.EndsWith(" (default)");
+		if ((bReset || Var.type == ListType) && Var.reset) {
+			if (!Var.reset(pObject)) {
+				sError = "unable to reset " + sVar;
+				return ApplyFailed;
+			}
+			if (bReset) {
+				NotifyWatches(GetScope(pObject), Var.name);
+				return ApplyChanged;
+			}
+		}
+
+		if (Var.type == ListType) {
+			VCString vsValues;
+			sVal.Split("\n", vsValues, false);
+			for (const CString& s : vsValues) {
+				if (!Var.set(pObject, s)) {
+					sError = "unable to set " + sVar;
+					return ApplyFailed;
+				}
+			}
+		} else if (!Var.set(pObject, sVal)) {
+			sError = "unable to set " + sVar;
+			return ApplyFailed;
+		}
+		NotifyWatches(GetScope(pObject), Var.name);
+		return ApplyChanged;
+	}
+
+	sError = "unknown variable " + sVar;
+	return ApplyFailed;
+}
+
+CAdminMod::ApplyResult CAdminMod::ApplyModules(CModules& Modules, CModInfo::EModuleType eType, CUser* pUser, CIRCNetwork* pNetwork, const CString& sVal, CString& sError)
+{
+	MCString msWanted;
+	VCString vsLines;
+	sVal.Split("\n", vsLines, false);
+	for (const CString& sLine : vsLines)
+		msWanted[sLine.Token(0)] = sLine.Token(1, true);
+
+	ApplyResult eResult = ApplyUnchanged;
+
+	VCString vsUnload;
+	for (const CModule* pModule : Modules) {
+		auto it = msWanted.find(pModule->GetModName());
+		if (it == msWanted.end()) {
+			// never unload ourselves in the middle of a command
+			if (pModule != this)
+				vsUnload.push_back(pModule->GetModName());
+		} else {
+			// nor reload, which would destroy the running instance
+			if (it->second != pModule->GetArgs() && pModule != this) {
+				if (!Modules.ReloadModule(it->first, it->second, pUser, pNetwork, sError))
+					return ApplyFailed;
+				eResult = ApplyChanged;
+			}
+			msWanted.erase(it);
+		}
+	}
+
+	for (const CString& sMod : vsUnload) {
+		if (!Modules.UnloadModule(sMod, sError))
+			return ApplyFailed;
+		eResult = ApplyChanged;
+	}
+
+	for (const auto& it : msWanted) {
+		if (!Modules.LoadModule(it.first, it.second, eType, pUser, pNetwork, sError))
+			return ApplyFailed;
+		eResult = ApplyChanged;
+	}
+
+	return eResult;
+}
+
+CAdminMod::ApplyResult CAdminMod::ApplyServers(CIRCNetwork* pNetwork, const CString& sVal)
+{
+	SCString ssWanted;
+	sVal.Split("\n", ssWanted, false);
+
+	ApplyResult eResult = ApplyUnchanged;
+
+	std::vector<const CServer*> vDelete;
+	for (const CServer* pServer : pNetwork->GetServers()) {
+		if (!ssWanted.erase(pServer->GetString()))
+			vDelete.push_back(pServer);
+	}
+
+	for (const CServer* pServer : vDelete) {
+		// copy, DelServer() deletes the server
+		const CString sHost = pServer->GetName();
+		const CString sPass = pServer->GetPass();
+		pNetwork->DelServer(sHost, pServer->GetPort(), sPass);
+		eResult = ApplyChanged;
+	}
+
+	for (const CString& sServer : ssWanted) {
+		if (!pNetwork->AddServer(sServer))
+			return ApplyFailed;
+		eResult = ApplyChanged;
+	}
+
+	return eResult;
+}
+
+CAdminMod::ApplyResult CAdminMod::ApplyPorts(const CString& sVal, CString& sError)
+{
+	CZNC& ZNC = CZNC::Get();
+
+	SCString ssWanted;
+	sVal.Split("\n", ssWanted, false);
+
+	ApplyResult eResult = ApplyUnchanged;
+
+	std::vector<CListener*> vDelete;
+	for (CListener* pListener : ZNC.GetListeners()) {
+		if (!ssWanted.erase(GetListenerString(pListener)))
+			vDelete.push_back(pListener);
+	}
+
+	for (CListener* pListener : vDelete) {
+		ZNC.DelListener(pListener);
+		eResult = ApplyChanged;
+	}
+
+	for (const CString& sPort : ssWanted) {
+		CListener* pListener = ParseListener(sPort);
+		if (!pListener) {
+			sError = "invalid port '" + sPort + "'";
+			return ApplyFailed;
+		}
+		if (!pListener->Listen()) {
+			sError = "unable to bind '" + sPort + "': " + CString(strerror(errno));
+			delete pListener;
+			return ApplyFailed;
+		}
+		if (!ZNC.AddListener(pListener)) {
+			sError = "internal error";
+			return ApplyFailed;
+		}
+		eResult = ApplyChanged;
+	}
+
+	return eResult;
+}
+
+void CAdminMod::SaveSnapshot(const CString& sName)
+{
+	ConfigSnapshot& Snapshot = m_mSnapshots[sName];
+	Snapshot.created = time(nullptr);
+	Snapshot.records.clear();
+
+	CollectConfig([&](const CString& sScope, const CString& sVar, const CString& sVal) {
+		Snapshot.records.push_back({m_Pool.Intern(sScope), m_Pool.Intern(sVar), m_Pool.Intern(sVal)});
+	});
+	Snapshot.records.shrink_to_fit();
+
+	// drop strings that were only referenced by an overwritten snapshot
+	CompactSnapshots();
+
+	PutSuccess("snapshot '" + sName + "' saved (" + CString(Snapshot.records.size()) + " values, " + CString(m_Pool.Size()) + " unique strings in total)");
+}
+
+void CAdminMod::RestoreSnapshot(const CString& sName)
+{
+	const ConfigSnapshot& Snapshot = m_mSnapshots[sName];
+
+	unsigned int uChanged = 0;
+	unsigned int uFailed = 0;
+
+	// users, networks and channels created after the snapshot are removed
+	SCString ssScopes;
+	for (const ConfigRecord& Record : Snapshot.records)
+		ssScopes.insert(m_Pool.Get(Record.scope).AsLower());
+
+	CZNC& ZNC = CZNC::Get();
+	VCString vsUsers;
+	for (const auto& it : ZNC.GetUserMap()) {
+		CUser* pUser = it.second;
+		if (!ssScopes.count(GetScope(pUser).AsLower())) {
+			vsUsers.push_back(pUser->GetUserName());
+			continue;
+		}
+
+		VCString vsNetworks;
+		for (CIRCNetwork* pNetwork : pUser->GetNetworks()) {
+			if (!ssScopes.count(GetScope(pNetwork).AsLower())) {
+				vsNetworks.push_back(pNetwork->GetName());
+				continue;
+			}
+
+			VCString vsChans;
+			for (const CChan* pChan : pNetwork->GetChans()) {
+				if (!ssScopes.count(GetScope(pChan).AsLower()))
+					vsChans.push_back(pChan->GetName());
+			}
+			for (const CString& sChan : vsChans) {
+				pNetwork->PutIRC("PART " + sChan);
+				pNetwork->DelChan(sChan);
+				++uChanged;
+			}
+		}
+
+		for (const CString& sNetwork : vsNetworks) {
+			if (pUser->DeleteNetwork(sNetwork)) {
+				NotifyWatches(pUser->GetUserName() + "/" + sNetwork, "@network");
+				++uChanged;
+			} else {
+				++uFailed;
+				PutError(pUser->GetUserName() + "/" + sNetwork + ": unable to delete");
+			}
+		}
+	}
+
+	for (const CString& sUser : vsUsers) {
+		if (sUser == GetUser()->GetUserName()) {
+			++uFailed;
+			PutError(sUser + ": cannot delete yourself");
+		} else if (ZNC.DeleteUser(sUser)) {
+			NotifyWatches(sUser, "@user");
+			++uChanged;
+		} else {
+			++uFailed;
+			PutError(sUser + ": unable to delete");
+		}
+	}
+
+	for (const ConfigRecord& Record : Snapshot.records) {
+		CString sError;
+		switch (ApplyConfig(m_Pool.Get(Record.scope), m_Pool.Get(Record.var), m_Pool.Get(Record.value), true, sError)) {
+		case ApplyChanged:
+			++uChanged;
+			break;
+		case ApplyFailed:
+			++uFailed;
+			PutError(m_Pool.Get(Record.scope) + ": " + sError);
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (uChanged && !ZNC.WriteConfig())
+		PutError("failed to write '" + ZNC.GetConfigFile() + "'");
+
+	if (uFailed)
+		PutError("snapshot '" + sName + "' partially restored (" + CString(uChanged) + " changed, " + CString(uFailed) + " failed)");
+	else
+		PutSuccess("snapshot '" + sName + "' restored (" + CString(uChanged) + " changed)");
+}
+
+void CAdminMod::CompactSnapshots()
+{
+	CStringPool Pool;
+	for (auto& it : m_mSnapshots) {
+		for (ConfigRecord& Record : it.second.records) {
+			Record.scope = Pool.Intern(m_Pool.Get(Record.scope));
+			Record.var = Pool.Intern(m_Pool.Get(Record.var));
+			Record.value = Pool.Intern(m_Pool.Get(Record.value));
+		}
+	}
+	m_Pool = std::move(Pool);
+}
+
+void CAdminMod::ExportConfig(const CString& sFile, const CString& sFilter)
+{
+	if (FindTimer("export")) {
+		PutError("an export is already in progress");
+		return;
+	}
+
+	const CString sPath = GetFilePath(sFile);
+	if (sPath.empty()) {
+		PutError("invalid file '" + sFile + "'");
+		return;
+	}
+
+	std::shared_ptr<CFile> pFile = std::make_shared<CFile>(sPath);
+	if (!pFile->Open(O_WRONLY | O_CREAT | O_TRUNC, 0600)) {
+		PutError("unable to open '" + sPath + "'");
+		return;
+	}
+
+	// one line per value: <scope> TAB <variable> TAB <value>, URL-escaped
+	std::shared_ptr<CString> pBuffer = std::make_shared<CString>();
+	ConfigVisitor Writer = [pBuffer](const CString& sScope, const CString& sVar, const CString& sVal) {
+		pBuffer->append(sScope.Escape_n(CString::EURL) + "\t" + sVar.Escape_n(CString::EURL) + "\t" + sVal.Escape_n(CString::EURL) + "\n");
+	};
+
+	if (sFilter.empty())
+		CollectGlobalConfig(Writer);
+
+	// the user map may change between batches, look users up by name
+	std::shared_ptr<VCString> pUsers = std::make_shared<VCString>();
+	for (const auto& it : CZNC::Get().GetUserMap()) {
+		if (sFilter.empty() || it.first.WildCmp(sFilter, CString::CaseInsensitive))
+			pUsers->push_back(it.first);
+	}
+
+	const CString sTarget = m_sTarget;
+	size_t uIndex = 0;
+
+	RunBatches("export", [=]() mutable {
+		for (unsigned int i = 0; i < BatchSize && uIndex < pUsers->size(); ++i) {
+			if (const CUser* pUser = CZNC::Get().FindUser((*pUsers)[uIndex++]))
+				CollectUserConfig(pUser, Writer);
+		}
+
+		pFile->Write(*pBuffer);
+		pBuffer->clear();
+
+		if (uIndex < pUsers->size())
+			return true;
+
+		pFile->Close();
+		PutSuccess("exported " + CString(pUsers->size()) + " users to '" + sPath + "'", sTarget);
+		return false;
+	});
+}
+
+void CAdminMod::ImportConfig(const CString& sFile)
+{
+	if (FindTimer("import")) {
+		PutError("an import is already in progress");
+		return;
+	}
+
+	const CString sPath = GetFilePath(sFile);
+	if (sPath.empty()) {
+		PutError("invalid file '" + sFile + "'");
+		return;
+	}
+
+	std::shared_ptr<CFile> pFile = std::make_shared<CFile>(sPath);
+	if (!pFile->Open(O_RDONLY)) {
+		PutError("unable to open '" + sPath + "'");
+		return;
+	}
+
+	const CString sTarget = m_sTarget;
+	unsigned int uChanged = 0;
+	unsigned int uFailed = 0;
+
+	RunBatches("import", [=]() mutable {
+		CString sLine;
+		for (unsigned int i = 0; i < BatchSize * 10; ++i) {
+			if (!pFile->ReadLine(sLine)) {
+				pFile->Close();
+				if (!CZNC::Get().WriteConfig())
+					PutError("failed to write '" + CZNC::Get().GetConfigFile() + "'", sTarget);
+				if (uFailed)
+					PutError("imported '" + sPath + "' with errors (" + CString(uChanged) + " changed, " + CString(uFailed) + " failed)", sTarget);
+				else
+					PutSuccess("imported '" + sPath + "' (" + CString(uChanged) + " changed)", sTarget);
+				return false;
+			}
+
+			sLine.TrimRight("\r\n");
+			if (sLine.empty() || sLine.StartsWith("#"))
+				continue;
+
+			const CString sScope = sLine.Token(0, false, "\t", true).Escape_n(CString::EURL, CString::EASCII);
+			const CString sVar = sLine.Token(1, false, "\t", true).Escape_n(CString::EURL, CString::EASCII);
+			const CString sVal = sLine.Token(2, false, "\t", true).Escape_n(CString::EURL, CString::EASCII);
+
+			CString sError;
+			switch (ApplyConfig(sScope, sVar, sVal, true, sError)) {
+			case ApplyChanged:
+				++uChanged;
+				break;
+			case ApplyFailed:
+				// keep the transcript short for large files
+				if (++uFailed <= 10)
+					PutError(sScope + ": " + sError, sTarget);
+				break;
+			default:
+				break;
+			}
+		}
+		return true;
+	});
+}
+
+void CAdminMod::AddUsers(const CString& sFile)
+{
+	if (FindTimer("addusers")) {
+		PutError("users are already being added");
+		return;
+	}
+
+	const CString sPath = GetFilePath(sFile);
+	CFile File(sPath);
+	if (sPath.empty() || !File.Open(O_RDONLY)) {
+		PutError("unable to open '" + sFile + "'");
+		return;
+	}
+
+	std::shared_ptr<std::vector<UserRow>> pRows = std::make_shared<std::vector<UserRow>>();
+	std::shared_ptr<VCString> pErrors = std::make_shared<VCString>();
+
+	// validate everything before creating anything
+	SCString ssUsernames;
+	CString sLine;
+	unsigned int uLine = 0;
+	while (File.ReadLine(sLine)) {
+		++uLine;
+		sLine.TrimRight("\r\n");
+		if (sLine.Trim_n().empty() || sLine.StartsWith("#"))
+			continue;
+
+		const CString sSep = sLine.find('\t') != CString::npos ? "\t" : ",";
+
+		UserRow Row;
+		Row.line = uLine;
+		Row.username = sLine.Token(0, false, sSep, true).Trim_n();
+		Row.password = sLine.Token(1, false, sSep, true).Trim_n();
+		Row.source = sLine.Token(2, false, sSep, true).Trim_n();
+		Row.hashed = Row.password.StartsWith("plain#") || Row.password.StartsWith("md5#") || Row.password.StartsWith("sha256#");
+
+		CString sError;
+		if (!CUser::IsValidUserName(Row.username))
+			sError = "invalid username '" + Row.username + "'";
+		else if (CZNC::Get().FindUser(Row.username))
+			sError = "user '" + Row.username + "' already exists";
+		else if (!ssUsernames.insert(Row.username).second)
+			sError = "duplicate username '" + Row.username + "'";
+		else if (Row.password.empty())
+			sError = "missing password";
+		else if (!Row.source.empty() && !CZNC::Get().FindUser(Row.source))
+			sError = "unknown template user '" + Row.source + "'";
+
+		if (sError.empty())
+			pRows->push_back(Row);
+		else
+			pErrors->push_back("line " + CString(uLine) + ": " + sError);
+	}
+	File.Close();
+
+	if (pRows->empty()) {
+		for (const CString& sError : *pErrors)
+			PutError(sError);
+		PutError("no users to add");
+		return;
+	}
+
+	PutLine("Adding " + CString(pRows->size()) + " users...");
+
+	const CString sTarget = m_sTarget;
+	std::shared_ptr<unsigned int> pAdded = std::make_shared<unsigned int>(0);
+	std::shared_ptr<bool> pBusy = std::make_shared<bool>(false);
+	size_t uNext = 0;
+
+	RunBatches("addusers", [=]() mutable {
+		if (*pBusy)
+			return true;
+
+		if (uNext >= pRows->size()) {
+			const size_t uErrors = pErrors->size();
+			for (size_t i = 0; i < uErrors && i < 20; ++i)
+				PutError((*pErrors)[i], sTarget);
+			if (uErrors > 20)
+				PutError("... and " + CString(uErrors - 20) + " more errors", sTarget);
+			if (!CZNC::Get().WriteConfig())
+				PutError("failed to write '" + CZNC::Get().GetConfigFile() + "'", sTarget);
+			if (uErrors)
+				PutError(CString(*pAdded) + " users added, " + CString(uErrors) + " failed", sTarget);
+			else
+				PutSuccess(CString(*pAdded) + " users added", sTarget);
+			return false;
+		}
+
+		const size_t uBegin = uNext;
+		const size_t uEnd = std::min<size_t>(uBegin + BatchSize, pRows->size());
+		uNext = uEnd;
+
+		// salts come from the main thread, CUtils::GetSalt() is not reentrant
+		for (size_t i = uBegin; i < uEnd; ++i) {
+			if (!(*pRows)[i].hashed)
+				(*pRows)[i].salt = CUtils::GetSalt();
+		}
+
+		auto fnHash = [pRows, uBegin, uEnd]() {
+			for (size_t i = uBegin; i < uEnd; ++i) {
+				UserRow& Row = (*pRows)[i];
+				if (!Row.hashed) {
+					Row.password = "sha256#" + CUser::SaltedHash(Row.password, Row.salt) + "#" + Row.salt + "#";
+					Row.hashed = true;
+				}
+			}
+		};
+		auto fnCreate = [this, pRows, pErrors, pAdded, pBusy, uBegin, uEnd]() {
+			CreateUsers(*pRows, uBegin, uEnd, *pAdded, *pErrors);
+			*pBusy = false;
+		};
+
+#ifdef HAVE_PTHREAD
+		*pBusy = true;
+		AddJob(new CAdminJob(this, "addusers", fnHash, fnCreate));
+#else
+		fnHash();
+		fnCreate();
+#endif
+		return true;
+	});
+}
+
+void CAdminMod::CreateUsers(std::vector<UserRow>& vRows, size_t uBegin, size_t uEnd, unsigned int& uAdded, VCString& vsErrors)
+{
+	for (size_t i = uBegin; i < uEnd; ++i) {
+		UserRow& Row = vRows[i];
+
+		CUser* pUser = new CUser(Row.username);
+		CString sError;
+		bool bAdded = false;
+
+		CUser* pSource = Row.source.empty() ? nullptr : CZNC::Get().FindUser(Row.source);
+		if (!Row.source.empty() && !pSource)
+			sError = "unknown template user '" + Row.source + "'";
+		else if (pSource && !pUser->Clone(*pSource, sError))
+			sError = "unable to clone '" + Row.source + "': " + sError;
+		// the password must be set after cloning, Clone() copies it
+		else if (!SetPassString(pUser, Row.password))
+			sError = "invalid password hash";
+		else
+			bAdded = CZNC::Get().AddUser(pUser, sError);
+
+		if (bAdded) {
+			NotifyWatches(GetScope(pUser), "@user");
+			++uAdded;
+		} else {
+			vsErrors.push_back("line " + CString(Row.line) + ": " + sError);
+			delete pUser;
+		}
+
+		// the plain text password is no longer needed
+		Row.password.clear();
+	}
+}
+
+void CAdminMod::CloneUsers(const CString& sSource, const CString& sTargets, bool bVarsOnly)
+{
+	if (FindTimer("cloneuser")) {
+		PutError("a clone is already in progress");
+		return;
+	}
+
+	const CUser* pSource = CZNC::Get().FindUser(sSource);
+	if (!pSource) {
+		PutError("unknown user '" + sSource + "'");
+		return;
+	}
+
+	std::shared_ptr<VCString> pTargets = std::make_shared<VCString>();
+	VCString vsPatterns;
+	sTargets.Split(",", vsPatterns, false);
+	for (const auto& it : CZNC::Get().GetUserMap()) {
+		if (it.second == pSource)
+			continue;
+		for (const CString& sPattern : vsPatterns) {
+			if (it.first.WildCmp(sPattern, CString::CaseInsensitive)) {
+				pTargets->push_back(it.first);
+				break;
+			}
+		}
+	}
+
+	if (pTargets->empty()) {
+		PutError("no matches for '" + sTargets + "'");
+		return;
+	}
+
+	// snapshot the source once, scopes relative to the user ("", "/network", ...)
+	std::shared_ptr<std::vector<ConfigRecord>> pRecords = std::make_shared<std::vector<ConfigRecord>>();
+	std::shared_ptr<CStringPool> pPool = std::make_shared<CStringPool>();
+	std::shared_ptr<SCString> pScopes = std::make_shared<SCString>();
+	CollectUserConfig(pSource, [&](const CString& sScope, const CString& sVar, const CString& sVal) {
+		const CString sRelative = sScope.substr(pSource->GetUserName().size());
+		// never copy the password, targets keep their own
+		if (sVar.Equals("@pass") || (bVarsOnly && (!sRelative.empty() || sVar.Equals("@modules"))))
+			return;
+		pRecords->push_back({pPool->Intern(sRelative), pPool->Intern(sVar), pPool->Intern(sVal)});
+		pScopes->insert(sRelative.AsLower());
+	});
+
+	PutLine("Cloning '" + sSource + "' into " + CString(pTargets->size()) + " users...");
+
+	const CString sTarget = m_sTarget;
+	const size_t uPerTick = std::max<size_t>(1, BatchSize * 10 / std::max<size_t>(1, pRecords->size()));
+	size_t uNext = 0;
+	unsigned int uCloned = 0;
+	unsigned int uFailed = 0;
+	std::shared_ptr<VCString> pErrors = std::make_shared<VCString>();
+
+	RunBatches("cloneuser", [=]() mutable {
+		for (size_t i = 0; i < uPerTick && uNext < pTargets->size(); ++i) {
+			const CString& sUser = (*pTargets)[uNext++];
+			CUser* pUser = CZNC::Get().FindUser(sUser);
+			if (!pUser) {
+				pErrors->push_back(sUser + ": user no longer exists");
+				++uFailed;
+				continue;
+			}
+
+			const size_t uErrors = pErrors->size();
+
+			// like CUser::Clone(), networks that the source does not have are
+			// deleted, and channels that it does not have leave the config
+			if (!bVarsOnly) {
+				VCString vsNetworks;
+				for (CIRCNetwork* pNetwork : pUser->GetNetworks()) {
+					const CString sNetwork = "/" + pNetwork->GetName();
+					if (!pScopes->count(sNetwork.AsLower())) {
+						vsNetworks.push_back(pNetwork->GetName());
+						continue;
+					}
+					for (CChan* pChan : pNetwork->GetChans()) {
+						if (!pScopes->count((sNetwork + "/" + pChan->GetName()).AsLower()))
+							pChan->SetInConfig(false);
+					}
+				}
+				for (const CString& sNetwork : vsNetworks) {
+					if (pUser->DeleteNetwork(sNetwork))
+						NotifyWatches(sUser + "/" + sNetwork, "@network");
+					else
+						pErrors->push_back(sUser + "/" + sNetwork + ": unable to delete");
+				}
+			}
+
+			// a failing value does not stop the rest
+			for (const ConfigRecord& Record : *pRecords) {
+				CString sError;
+				if (ApplyConfig(sUser + pPool->Get(Record.scope), pPool->Get(Record.var), pPool->Get(Record.value), true, sError) == ApplyFailed)
+					pErrors->push_back(sUser + pPool->Get(Record.scope) + ": " + sError);
+			}
+
+			if (pErrors->size() == uErrors)
+				++uCloned;
+			else
+				++uFailed;
+		}
+
+		if (uNext < pTargets->size())
+			return true;
+
+		for (size_t i = 0; i < pErrors->size() && i < 20; ++i)
+			PutError((*pErrors)[i], sTarget);
+		if (pErrors->size() > 20)
+			PutError("... and " + CString(pErrors->size() - 20) + " more errors", sTarget);
+		if (pErrors->empty())
+			PutSuccess("cloned '" + sSource + "' into " + CString(uCloned) + " users", sTarget);
+		else
+			PutError("cloned '" + sSource + "' into " + CString(uCloned) + " users, " + CString(uFailed) + " with errors", sTarget);
+		return false;
+	});
+}
+
+void CAdminMod::OnVarChanged(CUser* pUser, const CString& sVar, bool bReset)
+{
+	const CString sUser = pUser->GetUserName();
+	auto it = m_Shared.inherits.find(sUser);
+	if (it == m_Shared.inherits.end())
+		return;
+
+	SCString& ssLocal = m_Shared.localVars[sUser];
+	if (!bReset) {
+		ssLocal.insert(sVar);
+	} else {
+		// resetting falls back to the template, not to the default
+		ssLocal.erase(sVar);
+		auto itTemplate = m_Shared.templates.find(it->second);
+		if (itTemplate != m_Shared.templates.end()) {
+			auto itVal = itTemplate->second.find(sVar);
+			if (itVal != itTemplate->second.end()) {
+				CString sError;
+				ApplyVar(pUser, UserVars, sVar, itVal->second, sError);
+			}
+		}
+	}
+	SaveLocalVars(sUser);
+}
+
+CString CAdminMod::GetVarOrigin(const CUser* pUser, const CString& sVar) const
+{
+	auto it = m_Shared.inherits.find(pUser->GetUserName());
+	if (it == m_Shared.inherits.end())
+		return "";
+
+	auto itLocal = m_Shared.localVars.find(pUser->GetUserName());
+	if (itLocal != m_Shared.localVars.end() && itLocal->second.count(sVar))
+		return "(local)";
+
+	auto itTemplate = m_Shared.templates.find(it->second);
+	if (itTemplate != m_Shared.templates.end() && itTemplate->second.count(sVar))
+		return "(template " + it->second + ")";
+
+	return "";
+}
+
+void CAdminMod::LoadTemplates()
+{
+	// template:<name>[:<variable>], inherit:<user> and local:<user>,
+	// loaded by the first admin
+	if (!m_Shared.templates.empty() || !m_Shared.inherits.empty())
+		return;
+
+	m_Shared.templates.clear();
+	m_Shared.inherits.clear();
+	m_Shared.inheritors.clear();
+	m_Shared.localVars.clear();
+
+	for (const auto& it : GetSharedRegistry()) {
+		const CString sKind = it.first.Token(0, false, ":");
+		const CString sName = it.first.Token(1, false, ":");
+		const CString sVar = it.first.Token(2, false, ":");
+
+		if (sKind == "template") {
+			MCString& msVars = m_Shared.templates[sName];
+			if (!sVar.empty())
+				msVars[sVar] = it.second;
+		} else if (sKind == "inherit") {
+			m_Shared.inherits[sName] = it.second;
+			m_Shared.inheritors[it.second].insert(sName);
+		} else if (sKind == "local") {
+			it.second.Split(" ", m_Shared.localVars[sName], false);
+		}
+	}
+}
+
+void CAdminMod::SetTemplateVar(const CString& sTemplate, const CString& sVar, const CString& sVal)
+{
+	if (m_Shared.templates.find(sTemplate) == m_Shared.templates.end())
+		SetSharedNV("template:" + sTemplate, "", false);
+	m_Shared.templates[sTemplate][sVar] = sVal;
+	SetSharedNV("template:" + sTemplate + ":" + sVar, sVal);
+	ApplyTemplate(sTemplate, sVar);
+}
+
+void CAdminMod::ResetTemplateVar(const CString& sTemplate, const CString& sVar)
+{
+	auto it = m_Shared.templates.find(sTemplate);
+	if (it != m_Shared.templates.end())
+		it->second.erase(sVar);
+	DelSharedNV("template:" + sTemplate + ":" + sVar);
+	ApplyTemplate(sTemplate, sVar);
+}
+
+void CAdminMod::DelTemplate(const CString& sTemplate)
+{
+	// inheriting users keep their current values
+	auto itUsers = m_Shared.inheritors.find(sTemplate);
+	if (itUsers != m_Shared.inheritors.end()) {
+		for (const CString& sUser : itUsers->second) {
+			m_Shared.inherits.erase(sUser);
+			m_Shared.localVars.erase(sUser);
+			DelSharedNV("inherit:" + sUser, false);
+			DelSharedNV("local:" + sUser, false);
+		}
+		m_Shared.inheritors.erase(itUsers);
+	}
+
+	auto it = m_Shared.templates.find(sTemplate);
+	if (it != m_Shared.templates.end()) {
+		for (const auto& itVar : it->second)
+			DelSharedNV("template:" + sTemplate + ":" + itVar.first, false);
+		m_Shared.templates.erase(it);
+	}
+	DelSharedNV("template:" + sTemplate);
+}
+
+void CAdminMod::SetInherit(CUser* pUser, const CString& sTemplate)
+{
+	const CString sUser = pUser->GetUserName();
+
+	auto it = m_Shared.inherits.find(sUser);
+	if (it != m_Shared.inherits.end()) {
+		auto itUsers = m_Shared.inheritors.find(it->second);
+		if (itUsers != m_Shared.inheritors.end())
+			itUsers->second.erase(sUser);
+		m_Shared.inherits.erase(it);
+		m_Shared.localVars.erase(sUser);
+		DelSharedNV("inherit:" + sUser, false);
+		DelSharedNV("local:" + sUser);
+	}
+
+	auto itTemplate = m_Shared.templates.find(sTemplate);
+	if (itTemplate == m_Shared.templates.end())
+		return;
+
+	m_Shared.inherits[sUser] = sTemplate;
+	m_Shared.inheritors[sTemplate].insert(sUser);
+	SetSharedNV("inherit:" + sUser, sTemplate);
+
+	for (const auto& itVar : itTemplate->second) {
+		CString sError;
+		if (ApplyVar(pUser, UserVars, itVar.first, itVar.second, sError) == ApplyFailed)
+			PutError(sError);
+	}
+}
+
+void CAdminMod::ApplyTemplate(const CString& sTemplate, const CString& sVar)
+{
+	// only the users inheriting the template are visited, in batches
+	std::shared_ptr<VCString> pUsers = std::make_shared<VCString>();
+	auto itUsers = m_Shared.inheritors.find(sTemplate);
+	if (itUsers != m_Shared.inheritors.end())
+		pUsers->assign(itUsers->second.begin(), itUsers->second.end());
+	size_t uNext = 0;
+
+	// a pending run for the same variable is superseded by this one
+	const CString sLabel = "template:" + sTemplate + ":" + sVar;
+	RemTimer(sLabel);
+
+	RunBatches(sLabel, [=]() mutable {
+		for (unsigned int i = 0; i < BatchSize && uNext < pUsers->size(); ++i) {
+			const CString& sUser = (*pUsers)[uNext++];
+
+			// the user may have been detached, or inherit another
+			// template since the batch started
+			auto itInherit = m_Shared.inherits.find(sUser);
+			if (itInherit == m_Shared.inherits.end() || itInherit->second != sTemplate)
+				continue;
+
+			CUser* pUser = CZNC::Get().FindUser(sUser);
+			if (!pUser) {
+				// the user has been deleted
+				m_Shared.inherits.erase(itInherit);
+				m_Shared.localVars.erase(sUser);
+				auto itInheritors = m_Shared.inheritors.find(sTemplate);
+				if (itInheritors != m_Shared.inheritors.end())
+					itInheritors->second.erase(sUser);
+				DelSharedNV("inherit:" + sUser, false);
+				DelSharedNV("local:" + sUser);
+				continue;
+			}
+
+			auto itLocal = m_Shared.localVars.find(sUser);
+			if (itLocal != m_Shared.localVars.end() && itLocal->second.count(sVar))
+				continue;
+
+			// the template may have been deleted since the batch started
+			auto itTemplate = m_Shared.templates.find(sTemplate);
+			if (itTemplate == m_Shared.templates.end())
+				continue;
+
+			CString sError;
+			auto itVal = itTemplate->second.find(sVar);
+			if (itVal != itTemplate->second.end()) {
+				ApplyVar(pUser, UserVars, sVar, itVal->second, sError);
+			} else {
+				for (const auto& Var : UserVars) {
+					if (Var.name.Equals(sVar) && Var.reset)
+						Var.reset(pUser);
+				}
+			}
+		}
+		return uNext < pUsers->size();
+	});
+}
+
+void CAdminMod::SaveLocalVars(const CString& sUser)
+{
+	auto it = m_Shared.localVars.find(sUser);
+	if (it == m_Shared.localVars.end() || it->second.empty())
+		DelSharedNV("local:" + sUser);
+	else
+		SetSharedNV("local:" + sUser, CString(" ").Join(it->second.begin(), it->second.end()));
+}
+
+// matches a value against "n", "<n" or ">n", with an optional K, M or G suffix
+static bool MatchNumber(unsigned long long uValue, const CString& sExpr)
+{
+	CString sNum = sExpr.TrimLeft_n("<>=");
+	unsigned long long uMul = 1;
+	if (sNum.EndsWith("K", CString::CaseInsensitive))
+		uMul = 1024;
+	else if (sNum.EndsWith("M", CString::CaseInsensitive))
+		uMul = 1024 * 1024;
+	else if (sNum.EndsWith("G", CString::CaseInsensitive))
+		uMul = 1024 * 1024 * 1024;
+	if (uMul > 1)
+		sNum.RightChomp(1);
+
+	const unsigned long long uLimit = sNum.ToULongLong() * uMul;
+	if (sExpr.StartsWith("<"))
+		return uValue < uLimit;
+	if (sExpr.StartsWith(">"))
+		return uValue > uLimit;
+	return uValue == uLimit;
+}
+
+void CAdminMod::ListUsers(const CString& sArgs)
+{
+	CString sFilter;
+	CString sNetworks;
+	CString sTraffic;
+	CString sSort = "username";
+	bool bAdmin = false;
+	bool bConnected = false;
+	size_t uLimit = 0;
+
+	VCString vsArgs;
+	sArgs.Split(" ", vsArgs, false);
+	for (size_t i = 0; i < vsArgs.size(); ++i) {
+		const CString& sArg = vsArgs[i];
+		const CString sNext = i + 1 < vsArgs.size() ? vsArgs[i + 1] : "";
+		if (sArg.Equals("--admin")) {
+			bAdmin = true;
+		} else if (sArg.Equals("--connected")) {
+			bConnected = true;
+		} else if (sArg.Equals("--networks") && !sNext.empty()) {
+			sNetworks = sNext;
+			++i;
+		} else if (sArg.Equals("--traffic") && !sNext.empty()) {
+			sTraffic = sNext;
+			++i;
+		} else if (sArg.Equals("--sort") && !sNext.empty()) {
+			sSort = sNext;
+			++i;
+		} else if (sArg.Equals("--limit") && !sNext.empty()) {
+			uLimit = sNext.ToUInt();
+			++i;
+		} else if (sFilter.empty() && !sArg.StartsWith("--")) {
+			sFilter = sArg;
+		} else {
+			PutUsage("ListUsers [filter] [--admin] [--connected] [--networks <[<|>]n>] [--traffic <[<|>]bytes>] [--sort [-]<column>] [--limit <n>]");
+			return;
+		}
+	}
+
+	const bool bDescending = sSort.TrimPrefix("-");
+	if (!sSort.Equals("username") && !sSort.Equals("networks") && !sSort.Equals("clients") && !sSort.Equals("traffic")) {
+		PutError("unknown column '" + sSort + "' (username, networks, clients or traffic)");
+		return;
+	}
+
+	const std::map<CString, CUser*>& mUsers = CZNC::Get().GetUserMap();
+
+	// a plain prefix ("foo*") is looked up in the ordered user map instead of
+	// matching every user; user names are case sensitive
+	auto itBegin = mUsers.begin();
+	auto itEnd = mUsers.end();
+	CString sPrefix = sFilter;
+	if (sPrefix.TrimSuffix("*") && sPrefix.find_first_of("*?") == CString::npos) {
+		itBegin = mUsers.lower_bound(sPrefix);
+		itEnd = itBegin;
+		while (itEnd != mUsers.end() && itEnd->first.StartsWith(sPrefix))
+			++itEnd;
+	}
+
+	std::vector<const CUser*> vUsers;
+	for (auto it = itBegin; it != itEnd; ++it) {
+		const CUser* pUser = it->second;
+		if (!sFilter.empty() && !it->first.WildCmp(sFilter))
+			continue;
+		if (bAdmin && !pUser->IsAdmin())
+			continue;
+		if (bConnected && !pUser->IsUserAttached())
+			continue;
+		if (!sNetworks.empty() && !MatchNumber(pUser->GetNetworks().size(), sNetworks))
+			continue;
+		if (!sTraffic.empty() && !MatchNumber(pUser->BytesRead() + pUser->BytesWritten(), sTraffic))
+			continue;
+		vUsers.push_back(pUser);
+	}
+
+	if (vUsers.empty()) {
+		if (sArgs.empty())
+			PutLine("No users");
+		else
+			PutLine("No matches for '" + sArgs + "'");
+		return;
+	}
+
+	// the map is already sorted by username
+	if (!sSort.Equals("username") || bDescending) {
+		std::function<unsigned long long(const CUser*)> fnKey;
+		if (sSort.Equals("networks"))
+			fnKey = [](const CUser* pUser) -> unsigned long long { return pUser->GetNetworks().size(); };
+		else if (sSort.Equals("clients"))
+			fnKey = [](const CUser* pUser) -> unsigned long long { return pUser->GetAllClients().size(); };
+		else if (sSort.Equals("traffic"))
+			fnKey = [](const CUser* pUser) { return pUser->BytesRead() + pUser->BytesWritten(); };
+
+		if (fnKey) {
+			std::stable_sort(vUsers.begin(), vUsers.end(), [&](const CUser* a, const CUser* b) {
+				return bDescending ? fnKey(a) > fnKey(b) : fnKey(a) < fnKey(b);
+			});
+		} else {
+			std::reverse(vUsers.begin(), vUsers.end());
+		}
+	}
+
+	const size_t uTotal = vUsers.size();
+	if (uLimit && uLimit < vUsers.size())
+		vUsers.resize(uLimit);
+
+	CAdminTable Table(m_sArena, { "Username", "Networks", "Clients", "Traffic" });
+	Table.Reserve(vUsers.size(), 48);
+
+	for (const CUser* pUser : vUsers) {
+		Table.AddRow();
+		Table.SetCell(0, pUser->GetUserName() + (pUser->IsAdmin() ? " (admin)" : ""));
+		Table.SetCell(1, CString(pUser->GetNetworks().size()));
+		Table.SetCell(2, CString(pUser->GetAllClients().size()));
+		Table.SetCell(3, CString::ToByteStr(pUser->BytesRead() + pUser->BytesWritten()));
+	}
+
+	PutTable(Table);
+	if (vUsers.size() < uTotal)
+		PutLine("Showing " + CString(vUsers.size()) + " of " + CString(uTotal) + " users");
+}
+
+void CAdminMod::SampleListeners()
+{
+	const std::vector<CListener*>& vListeners = CZNC::Get().GetListeners();
+
+	std::map<const CListener*, ListenerStats> mStats;
+	std::set<const CListener*> ssNew;
+	for (const CListener* pListener : vListeners) {
+		ListenerStats& Stats = mStats[pListener];
+		auto it = m_mListenerStats.find(pListener);
+		if (it != m_mListenerStats.end()) {
+			Stats = it->second;
+		} else {
+			Stats = {0, 0, 0, 0, 0};
+			ssNew.insert(pListener);
+			// restores the tuning of listeners (re)created by ZNC, another
+			// admin or a rehash, the options are shared by all admins
+			ListenerOptions Options;
+			CString sPositional, sError;
+			const CString sOptions = GetSharedNV("listener:" + GetListenerString(pListener));
+			if (!sOptions.empty() && ParseListenerOptions(sOptions, sPositional, Options)) {
+				m_mListenerOptions[pListener] = Options;
+				if (!ApplyListenerOptions(pListener, Options, sError))
+					DEBUG("admin: " << sError);
+			}
+		}
+		Stats.open = 0;
+	}
+
+	std::map<const CListener*, unsigned int> mAccepted;
+	std::map<const CListener*, uint64_t> mNewest;
+	std::map<const CListener*, std::vector<Csock*>> mNew;
+
+	// accepted connections are the inbound sockets on the listening port;
+	// connections opened and closed within one interval are not seen
+	for (Csock* pSock : CZNC::Get().GetManager()) {
+		// closed by another admin, or by ZNC
+		if (pSock->GetType() != Csock::INBOUND || pSock->GetCloseType() != Csock::CLT_DONT)
+			continue;
+
+		for (const CListener* pListener : vListeners) {
+			if (pListener->GetPort() != pSock->GetLocalPort())
+				continue;
+			if (!pListener->GetBindHost().empty() && pListener->GetBindHost() != pSock->GetLocalIP())
+				continue;
+
+			ListenerStats& Stats = mStats[pListener];
+			++Stats.open;
+			if (pSock->GetStartTime() > Stats.newest) {
+				++mAccepted[pListener];
+				mNewest[pListener] = std::max(mNewest[pListener], pSock->GetStartTime());
+				mNew[pListener].push_back(pSock);
+			}
+			break;
+		}
+	}
+
+	// --max-rate: the connections accepted beyond the limit during the
+	// interval are closed, the newest first, because ZNC keeps accepting
+	// as long as the listening socket is readable
+	for (auto& it : mNew) {
+		auto itOptions = m_mListenerOptions.find(it.first);
+		if (itOptions == m_mListenerOptions.end() || !itOptions->second.maxRate || ssNew.count(it.first))
+			continue;
+		std::vector<Csock*>& vSocks = it.second;
+		const size_t uAllowed = (size_t) itOptions->second.maxRate * ListenerInterval;
+		if (vSocks.size() <= uAllowed)
+			continue;
+		std::sort(vSocks.begin(), vSocks.end(), [](const Csock* pA, const Csock* pB) {
+			return pA->GetStartTime() < pB->GetStartTime();
+		});
+		ListenerStats& Stats = mStats[it.first];
+		for (size_t i = uAllowed; i < vSocks.size(); ++i) {
+			vSocks[i]->Close();
+			--Stats.open;
+			++Stats.rejected;
+		}
+		DEBUG("admin: closed " << vSocks.size() - uAllowed << " connections to port " << it.first->GetPort() << " over --max-rate");
+	}
+
+	for (auto& it : mStats) {
+		// connections open before the first sample were not accepted by us
+		const unsigned int uAccepted = ssNew.count(it.first) ? 0 : mAccepted[it.first];
+		it.second.accepted += uAccepted;
+		it.second.rate = (double) uAccepted / ListenerInterval;
+		if (mAccepted[it.first])
+			it.second.newest = mNewest[it.first];
+	}
+
+	// drops the statistics of deleted listeners
+	m_mListenerStats = std::move(mStats);
+	for (auto it = m_mListenerOptions.begin(); it != m_mListenerOptions.end();) {
+		if (m_mListenerStats.count(it->first))
+			++it;
+		else
+			it = m_mListenerOptions.erase(it);
+	}
+}
+
+bool CAdminMod::ParseListenerOptions(const CString& sArgs, CString& sPositional, ListenerOptions& Options)
+{
+	VCString vsArgs;
+	sArgs.Split(" ", vsArgs, false);
+	for (size_t i = 0; i < vsArgs.size(); ++i) {
+		const CString& sArg = vsArgs[i];
+		if (!sArg.StartsWith("--")) {
+			sPositional += (sPositional.empty() ? "" : " ") + sArg;
+			continue;
+		}
+		if (i + 1 >= vsArgs.size())
+			return false;
+		const CString& sVal = vsArgs[++i];
+		if (sArg.Equals("--backlog"))
+			Options.backlog = sVal.ToInt();
+		else if (sArg.Equals("--defer-accept"))
+			Options.deferAccept = sVal.ToInt();
+		else if (sArg.Equals("--fastopen"))
+			Options.fastOpen = sVal.ToInt();
+		else if (sArg.Equals("--max-rate"))
+			Options.maxRate = sVal.ToUInt();
+		else
+			return false;
+	}
+	return true;
+}
+
+bool CAdminMod::ApplyListenerOptions(const CListener* pListener, const ListenerOptions& Options, CString& sError)
+{
+	CRealListener* pReal = pListener->GetRealListener();
+	if (!pReal) {
+		sError = "not listening";
+		return false;
+	}
+
+	const int iSock = pReal->GetRSock();
+
+	// listen() on a listening socket updates its backlog on Linux
+	if (Options.backlog && listen(iSock, Options.backlog) != 0) {
+		sError = "backlog: " + CString(strerror(errno));
+		return false;
+	}
+#ifdef TCP_DEFER_ACCEPT
+	if (Options.deferAccept && setsockopt(iSock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &Options.deferAccept, sizeof(Options.deferAccept)) != 0) {
+		sError = "defer-accept: " + CString(strerror(errno));
+		return false;
+	}
+#endif
+#ifdef TCP_FASTOPEN
+	if (Options.fastOpen && setsockopt(iSock, IPPROTO_TCP, TCP_FASTOPEN, &Options.fastOpen, sizeof(Options.fastOpen)) != 0) {
+		sError = "fastopen: " + CString(strerror(errno));
+		return false;
+	}
+#endif
+	return true;
+}
+
+void CAdminMod::BenchPort(unsigned short uPort, unsigned int uCount, unsigned int uParallel)
+{
+	const CListener* pListener = nullptr;
+	for (const CListener* pCandidate : CZNC::Get().GetListeners()) {
+		if (pCandidate->GetPort() == uPort)
+			pListener = pCandidate;
+	}
+	if (!pListener) {
+		PutError("no matching port");
+		return;
+	}
+
+	CString sHost = pListener->GetBindHost();
+	if (sHost.empty() || sHost == "*")
+		sHost = pListener->GetAddrType() == ADDR_IPV6ONLY ? "::1" : "127.0.0.1";
+	const CString sTuning = GetSharedNV("listener:" + GetListenerString(pListener));
+	const CString sTarget = m_sTarget;
+
+	std::shared_ptr<PortBenchResult> pResult = std::make_shared<PortBenchResult>();
+
+	auto fnRun = [=]() {
+		RunPortBench(sHost, uPort, uCount, uParallel, *pResult);
+	};
+	auto fnReport = [=]() {
+		if (!pResult->error.empty()) {
+			PutError(pResult->error, sTarget);
+			return;
+		}
+		const unsigned int uDone = pResult->connected;
+		// reported outside of a command, which resets the arena
+		CAdminTable::ResetArena(m_sArena, TableArenaKeep);
+		CAdminTable Table(m_sArena, { "Metric", "Value" });
+		auto AddRow = [&](const CString& sMetric, const CString& sValue) {
+			Table.AddRow();
+			Table.SetCell(0, sMetric);
+			Table.SetCell(1, sValue);
+		};
+		AddRow("Connections", CString(uDone) + " (" + CString(pResult->failures) + " failed)");
+		AddRow("Connects/s", pResult->wallMs > 0 ? CString(uDone * 1000.0 / pResult->wallMs) : "-");
+		AddRow("Latency", uDone ? CString(pResult->sumMs / uDone) + " ms avg, " + CString(pResult->maxMs) + " ms max" : "-");
+		AddRow("Tuning", sTuning.empty() ? CString("-") : sTuning);
+		PutTable(Table, sTarget);
+	};
+
+	// the connections are made from a thread, so that the main loop
+	// accepts them as it would accept real clients
+#ifdef HAVE_PTHREAD
+	PutLine("Opening " + CString(uCount) + " connections to " + sHost + " port " + CString(uPort) + "...");
+	AddJob(new CAdminJob(this, "portbench", fnRun, fnReport));
+#else
+	PutError("ZNC was built without threads");
+#endif
+}
+
+void CAdminMod::RunPortBench(const CString& sHost, unsigned short uPort, unsigned int uCount, unsigned int uParallel, PortBenchResult& Result)
+{
+	addrinfo Hints = {};
+	Hints.ai_socktype = SOCK_STREAM;
+	Hints.ai_flags = AI_NUMERICHOST;
+	addrinfo* pAddr = nullptr;
+	if (getaddrinfo(sHost.c_str(), CString(uPort).c_str(), &Hints, &pAddr) != 0 || !pAddr) {
+		Result.error = "invalid address '" + sHost + "'";
+		return;
+	}
+
+	auto fnNow = []() {
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+	};
+
+	const double dStart = fnNow();
+	std::vector<pollfd> vFDs;
+	std::vector<double> vStarts;
+	for (unsigned int uDone = 0; uDone < uCount; uDone += vStarts.size()) {
+		// a batch of non-blocking connects, waited for together
+		vFDs.clear();
+		vStarts.clear();
+		const unsigned int uBatch = std::min(uParallel, uCount - uDone);
+		for (unsigned int i = 0; i < uBatch; ++i) {
+			const int iFD = socket(pAddr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			vStarts.push_back(fnNow());
+			if (iFD < 0 || (connect(iFD, pAddr->ai_addr, pAddr->ai_addrlen) != 0 && errno != EINPROGRESS)) {
+				if (iFD >= 0)
+					close(iFD);
+				++Result.failures;
+				vFDs.push_back({-1, 0, 0});
+				continue;
+			}
+			vFDs.push_back({iFD, POLLOUT, 0});
+		}
+
+		size_t uPending = std::count_if(vFDs.begin(), vFDs.end(), [](const pollfd& FD) { return FD.fd >= 0; });
+		while (uPending && poll(vFDs.data(), vFDs.size(), 5000) > 0) {
+			for (size_t i = 0; i < vFDs.size(); ++i) {
+				pollfd& FD = vFDs[i];
+				if (FD.fd < 0 || !FD.revents)
+					continue;
+				int iError = 0;
+				socklen_t uLen = sizeof(iError);
+				if (getsockopt(FD.fd, SOL_SOCKET, SO_ERROR, &iError, &uLen) != 0 || iError != 0) {
+					++Result.failures;
+				} else {
+					const double dMs = fnNow() - vStarts[i];
+					++Result.connected;
+					Result.sumMs += dMs;
+					Result.maxMs = std::max(Result.maxMs, dMs);
+				}
+				// negative descriptors are ignored by poll()
+				close(FD.fd);
+				FD.fd = -1;
+				--uPending;
+			}
+		}
+
+		// timed out
+		for (pollfd& FD : vFDs) {
+			if (FD.fd >= 0) {
+				close(FD.fd);
+				++Result.failures;
+			}
+		}
+	}
+	Result.wallMs = fnNow() - dStart;
+	freeaddrinfo(pAddr);
+}
+
+bool CAdminMod::CheckCert(const CString& sFile, VCString& vsInfo, CString& sError)
+{
+#ifdef HAVE_LIBSSL
+	// the same setup ZNC does for every incoming TLS connection
+	timeval tvStart, tvEnd;
+	gettimeofday(&tvStart, nullptr);
+
+	const CZNC& ZNC = CZNC::Get();
+	SSL_CTX* pCtx = SSL_CTX_new(SSLv23_server_method());
+	bool bValid = pCtx && UseCertFiles(pCtx, sFile, ZNC.GetSSLKeyFile(), ZNC.GetSSLDHParamFile());
+
+	gettimeofday(&tvEnd, nullptr);
+
+	if (!bValid) {
+		char szError[256];
+		ERR_error_string_n(ERR_get_error(), szError, sizeof(szError));
+		sError = szError;
+		ERR_clear_error();
+		SSL_CTX_free(pCtx);
+		return false;
+	}
+
+	if (X509* pCert = SSL_CTX_get0_certificate(pCtx)) {
+		char szSubject[256];
+		X509_NAME_oneline(X509_get_subject_name(pCert), szSubject, sizeof(szSubject));
+		vsInfo.push_back("Subject: " + CString(szSubject));
+
+		BIO* pBio = BIO_new(BIO_s_mem());
+		ASN1_TIME_print(pBio, X509_get_notAfter(pCert));
+		char* pData = nullptr;
+		long lLen = BIO_get_mem_data(pBio, &pData);
+		vsInfo.push_back("Expires: " + CString(pData, lLen));
+		BIO_free(pBio);
+	}
+	SSL_CTX_free(pCtx);
+
+	const double dMs = (tvEnd.tv_sec - tvStart.tv_sec) * 1000.0 + (tvEnd.tv_usec - tvStart.tv_usec) / 1000.0;
+	vsInfo.push_back("Context setup: " + CString(dMs) + " ms" + (m_dCertSetupMs > 0 ? " (was " + CString(m_dCertSetupMs) + " ms)" : ""));
+	m_dCertSetupMs = dMs;
+	return true;
+#else
+	sError = "ZNC was built without TLS support";
+	return false;
+#endif
+}
+
+void CAdminMod::ReloadCert(const CString& sFile, const CString& sTarget)
+{
+	CZNC& ZNC = CZNC::Get();
+	const CString sPath = sFile.empty() ? ZNC.GetSSLCertFile() : sFile;
+
+	VCString vsInfo;
+	CString sError;
+	if (!CheckCert(sPath, vsInfo, sError)) {
+		PutError("invalid certificate '" + sPath + "': " + sError, sTarget);
+		return;
+	}
+
+	for (const CString& sInfo : vsInfo)
+		PutLine(sInfo, sTarget);
+
+	// ZNC loads the file for each new connection, so switching the path
+	// only after validation is enough to swap it in safely
+	if (sPath != ZNC.GetSSLCertFile())
+		ZNC.SetSSLCertFile(sPath);
+	m_Shared.certMTime = CFile(sPath).GetMTime();
+
+	PutSuccess("using '" + sPath + "' for new connections", sTarget);
+}
+
+void CAdminMod::WatchCert(bool bWatch)
+{
+	if (!bWatch) {
+		DelSharedNV("certwatch");
+		if (m_Shared.certWatcher)
+			m_Shared.certWatcher->RemTimer("certwatch");
+		m_Shared.certWatcher = nullptr;
+		return;
+	}
+
+	if (!GetSharedNV("certwatch").ToBool())
+		SetSharedNV("certwatch", "true");
+	// one timer for all admins, taken over by another admin on unload
+	if (m_Shared.certWatcher)
+		return;
+	m_Shared.certWatcher = this;
+	m_Shared.certMTime = CFile(CZNC::Get().GetSSLCertFile()).GetMTime();
+
+	AddTimer(new CAdminTimer(this, 60, "certwatch", [this]() {
+		const CString sPath = CZNC::Get().GetSSLCertFile();
+		const time_t tMTime = CFile(sPath).GetMTime();
+		if (tMTime != m_Shared.certMTime) {
+			m_Shared.certMTime = tMTime;
+			PutLine("'" + sPath + "' has changed, validating...", GetModName());
+			ReloadCert(sPath, GetModName());
+		}
+		return true;
+	}));
+}
+
+void CAdminMod::BenchTLS(unsigned int uCount)
+{
+#ifdef HAVE_LIBSSL
+	const CZNC& ZNC = CZNC::Get();
+	const CString sCertFile = ZNC.GetSSLCertFile();
+	const CString sKeyFile = ZNC.GetSSLKeyFile();
+	const CString sDHParamFile = ZNC.GetSSLDHParamFile();
+	const CString sCiphers = ZNC.GetSSLCiphers();
+	const CString sProtocols = ZNC.GetSSLProtocols();
+	const CString sTarget = m_sTarget;
+
+	std::shared_ptr<TLSBenchResult> pResult = std::make_shared<TLSBenchResult>();
+
+	auto fnRun = [=]() {
+		RunTLSBench(sCertFile, sKeyFile, sDHParamFile, sCiphers, sProtocols, uCount, *pResult);
+	};
+	auto fnReport = [=]() {
+		if (!pResult->error.empty()) {
+			PutError(pResult->error, sTarget);
+			return;
+		}
+		const unsigned int uDone = pResult->handshakes;
+		// reported outside of a command, which resets the arena
+		CAdminTable::ResetArena(m_sArena, TableArenaKeep);
+		CAdminTable Table(m_sArena, { "Metric", "Value" });
+		auto AddRow = [&](const CString& sMetric, const CString& sValue) {
+			Table.AddRow();
+			Table.SetCell(0, sMetric);
+			Table.SetCell(1, sValue);
+		};
+		AddRow("Handshakes", CString(uDone) + " (" + CString(pResult->failures) + " failed)");
+		AddRow("Handshakes/s", pResult->wallMs > 0 ? CString(uDone * 1000.0 / pResult->wallMs) : "-");
+		AddRow("Server CPU/handshake", uDone ? CString(pResult->cpuMs / uDone) + " ms" : "-");
+		AddRow("Protocol", pResult->protocol);
+		AddRow("Cipher", pResult->cipher);
+		AddRow("Resumed", uDone > 1 ? CString(pResult->resumed * 100.0 / (uDone - 1)) + "%" : "-");
+		PutTable(Table, sTarget);
+	};
+
+	PutLine("Running " + CString(uCount) + " handshakes...");
+#ifdef HAVE_PTHREAD
+	AddJob(new CAdminJob(this, "tlsbench", fnRun, fnReport));
+#else
+	fnRun();
+	fnReport();
+#endif
+#else
+	PutError("ZNC was built without TLS support");
+#endif
+}
+
+void CAdminMod::RunTLSBench(const CString& sCertFile, const CString& sKeyFile, const CString& sDHParamFile, const CString& sCiphers, const CString& sProtocols, unsigned int uCount, TLSBenchResult& Result)
+{
+#ifdef HAVE_LIBSSL
+	SSL_CTX* pServerCtx = SSL_CTX_new(SSLv23_server_method());
+	SSL_CTX* pClientCtx = SSL_CTX_new(SSLv23_client_method());
+	if (!pServerCtx || !pClientCtx
+			|| !UseCertFiles(pServerCtx, sCertFile, sKeyFile, sDHParamFile)
+			|| (!sCiphers.empty() && SSL_CTX_set_cipher_list(pServerCtx, sCiphers.c_str()) != 1)) {
+		char szError[256];
+		ERR_error_string_n(ERR_get_error(), szError, sizeof(szError));
+		Result.error = "unable to set up TLS: " + CString(szError);
+		SSL_CTX_free(pServerCtx);
+		SSL_CTX_free(pClientCtx);
+		return;
+	}
+
+	// the same [+|-]<protocol> syntax as SSLProtocols, SSLv2/3 off by default
+	long lOptions = 0;
+	std::map<CString, long> mProtocols;
+#ifdef SSL_OP_NO_SSLv2
+	mProtocols["SSLv2"] = SSL_OP_NO_SSLv2;
+	lOptions |= SSL_OP_NO_SSLv2;
+#endif
+#ifdef SSL_OP_NO_SSLv3
+	mProtocols["SSLv3"] = SSL_OP_NO_SSLv3;
+	lOptions |= SSL_OP_NO_SSLv3;
+#endif
+#ifdef SSL_OP_NO_TLSv1
+	mProtocols["TLSv1"] = SSL_OP_NO_TLSv1;
+#endif
+#ifdef SSL_OP_NO_TLSv1_1
+	mProtocols["TLSv1.1"] = SSL_OP_NO_TLSv1_1;
+#endif
+#ifdef SSL_OP_NO_TLSv1_2
+	mProtocols["TLSv1.2"] = SSL_OP_NO_TLSv1_2;
+#endif
+#ifdef SSL_OP_NO_TLSv1_3
+	mProtocols["TLSv1.3"] = SSL_OP_NO_TLSv1_3;
+#endif
+	VCString vsProtocols;
+	sProtocols.Split(" ", vsProtocols, false);
+	for (const CString& sProtocol : vsProtocols) {
+		const bool bDisable = sProtocol.StartsWith("-");
+		const CString sName = sProtocol.TrimLeft_n("+-");
+		for (const auto& it : mProtocols) {
+			if (sName.Equals("all") || sName.Equals(it.first)) {
+				if (bDisable)
+					lOptions |= it.second;
+				else
+					lOptions &= ~it.second;
+			}
+		}
+	}
+	SSL_CTX_set_options(pServerCtx, lOptions);
+
+	static const unsigned char SessionContext[] = "znc-admin";
+	SSL_CTX_set_session_id_context(pServerCtx, SessionContext, sizeof(SessionContext) - 1);
+	SSL_CTX_set_verify(pClientCtx, SSL_VERIFY_NONE, nullptr);
+
+	SSL_SESSION* pSession = nullptr;
+
+	// only the server side is timed, the client runs in the same thread
+	timespec tsWallStart, tsWallEnd;
+	clock_gettime(CLOCK_MONOTONIC, &tsWallStart);
+	auto fnServer = [&](const std::function<int()>& fnCall) {
+		timespec tsStart, tsEnd;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tsStart);
+		const int iRet = fnCall();
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tsEnd);
+		Result.cpuMs += (tsEnd.tv_sec - tsStart.tv_sec) * 1000.0 + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1000000.0;
+		return iRet;
+	};
+
+	for (unsigned int i = 0; i < uCount; ++i) {
+		// an in-memory BIO pair measures the TLS cost without the network
+		SSL* pServer = SSL_new(pServerCtx);
+		SSL* pClient = SSL_new(pClientCtx);
+		BIO* pServerBio = nullptr;
+		BIO* pClientBio = nullptr;
+		BIO_new_bio_pair(&pServerBio, 0, &pClientBio, 0);
+		SSL_set_bio(pServer, pServerBio, pServerBio);
+		SSL_set_bio(pClient, pClientBio, pClientBio);
+		SSL_set_accept_state(pServer);
+		SSL_set_connect_state(pClient);
+		if (pSession)
+			SSL_set_session(pClient, pSession);
+
+		bool bDone = false;
+		for (int iRound = 0; iRound < 100 && !bDone; ++iRound) {
+			const int iClient = SSL_do_handshake(pClient);
+			const int iServer = fnServer([pServer]() { return SSL_do_handshake(pServer); });
+			bDone = iClient == 1 && iServer == 1;
+			if (!bDone
+					&& (iClient != 1 && SSL_get_error(pClient, iClient) != SSL_ERROR_WANT_READ && SSL_get_error(pClient, iClient) != SSL_ERROR_WANT_WRITE))
+				break;
+			if (!bDone
+					&& (iServer != 1 && SSL_get_error(pServer, iServer) != SSL_ERROR_WANT_READ && SSL_get_error(pServer, iServer) != SSL_ERROR_WANT_WRITE))
+				break;
+		}
+
+		if (bDone) {
+			++Result.handshakes;
+			if (SSL_session_reused(pClient))
+				++Result.resumed;
+			Result.cipher = SSL_get_cipher_name(pClient);
+			Result.protocol = SSL_get_version(pClient);
+
+			// TLS 1.3 session tickets follow the handshake, one more read
+			// lets the client process them before the session is taken
+			char cByte;
+			SSL_read(pClient, &cByte, 1);
+			ERR_clear_error();
+			if (pSession)
+				SSL_SESSION_free(pSession);
+			pSession = SSL_get1_session(pClient);
+
+			// without a clean shutdown the session is not resumable and is
+			// removed from the server cache
+			SSL_shutdown(pClient);
+			fnServer([pServer]() { return SSL_shutdown(pServer); });
+		} else {
+			++Result.failures;
+			char szError[256];
+			ERR_error_string_n(ERR_get_error(), szError, sizeof(szError));
+			Result.error = Result.handshakes ? "" : "handshake failed: " + CString(szError);
+			ERR_clear_error();
+		}
+
+		SSL_free(pServer);
+		SSL_free(pClient);
+
+		if (!Result.error.empty())
+			break;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &tsWallEnd);
+	Result.wallMs = (tsWallEnd.tv_sec - tsWallStart.tv_sec) * 1000.0 + (tsWallEnd.tv_nsec - tsWallStart.tv_nsec) / 1000000.0;
+
+	if (pSession)
+		SSL_SESSION_free(pSession);
+	SSL_CTX_free(pServerCtx);
+	SSL_CTX_free(pClientCtx);
+#endif
+}
+
+void CAdminMod::CheckAutoDetach()
+{
+	const time_t tNow = time(nullptr);
+
+	for (CIRCNetwork* pNetwork : GetUser()->GetNetworks()) {
+		const unsigned int uDays = GetAutoDetachDays(pNetwork);
+
+		for (CChan* pChan : pNetwork->GetChans()) {
+			const CString sKey = GetChanKey(pChan);
+
+			// attached again by the user
+			auto itDetached = m_mAutoDetached.find(sKey);
+			if (itDetached != m_mAutoDetached.end() && !pChan->IsDetached())
+				m_mAutoDetached.erase(itDetached);
+
+			// channels are considered active when first seen
+			auto itActivity = m_mChanActivity.find(sKey);
+			if (itActivity == m_mChanActivity.end()) {
+				m_mChanActivity[sKey] = tNow;
+				continue;
+			}
+
+			if (uDays && pChan->IsOn() && !pChan->IsDetached() && tNow - itActivity->second > (time_t) uDays * 24 * 60 * 60) {
+				pChan->DetachUser();
+				m_mAutoDetached[sKey] = {tNow, 0, 0};
+			}
+		}
+	}
+
+	SaveAutoDetach();
+}
+
+void CAdminMod::SaveAutoDetach() const
+{
+	// saved hourly and on unload, so that a reload or restart does not
+	// reset the idle times; at most an hour of activity is lost on a crash
+	const CString sFile = GetSavePath() + "/autodetach";
+	if (m_mChanActivity.empty() && m_mAutoDetached.empty()) {
+		CFile::Delete(sFile);
+		return;
+	}
+
+	// a <time> <network/#chan>, or d <since> <lines> <bytes> <network/#chan>
+	CString sOut;
+	for (const auto& it : m_mChanActivity)
+		sOut += "a " + CString(it.second) + " " + it.first + "\n";
+	for (const auto& it : m_mAutoDetached)
+		sOut += "d " + CString(it.second.since) + " " + CString(it.second.lines) + " " + CString(it.second.bytes) + " " + it.first + "\n";
+
+	CFile File(sFile + ".tmp");
+	if (!File.Open(O_WRONLY | O_CREAT | O_TRUNC, 0600) || File.Write(sOut) != (ssize_t) sOut.size()) {
+		DEBUG("admin: failed to write '" << sFile << "'");
+		return;
+	}
+	File.Close();
+	CFile::Move(sFile + ".tmp", sFile, true);
+}
+
+void CAdminMod::LoadAutoDetach()
+{
+	CFile File(GetSavePath() + "/autodetach");
+	if (!File.Open(O_RDONLY))
+		return;
+
+	CString sLine;
+	while (File.ReadLine(sLine)) {
+		sLine.TrimRight("\r\n");
+		if (sLine.Token(0) == "a")
+			m_mChanActivity[sLine.Token(2, true)] = sLine.Token(1).ToLongLong();
+		else if (sLine.Token(0) == "d")
+			m_mAutoDetached[sLine.Token(4, true)] = {(time_t) sLine.Token(1).ToLongLong(), sLine.Token(2).ToUInt(), sLine.Token(3).ToULongLong()};
+	}
+}
+
+void CAdminMod::OnChanActivity(CChan* pChan, const CMessage& Message, bool bOwn)
+{
+	const CString sKey = GetChanKey(pChan);
+
+	if (bOwn) {
+		m_mChanActivity[sKey] = time(nullptr);
+		if (m_mAutoDetached.erase(sKey) && pChan->IsDetached())
+			pChan->AttachUser();
+		return;
+	}
+
+	auto it = m_mAutoDetached.find(sKey);
+	if (it != m_mAutoDetached.end()) {
+		++it->second.lines;
+		it->second.bytes += Message.ToString().size() * std::max<size_t>(1, GetUser()->GetAllClients().size());
+	}
+}
+
+unsigned int CAdminMod::GetAutoDetachDays(const CIRCNetwork* pNetwork) const
+{
+	const CString sDays = GetNV("autodetach:" + pNetwork->GetName());
+	if (!sDays.empty())
+		return sDays.ToUInt();
+	return GetNV("autodetach").ToUInt();
+}
+
+CString CAdminMod::GetChanKey(const CChan* pChan)
+{
+	return pChan->GetNetwork()->GetName() + "/" + pChan->GetName().AsLower();
+}
+
+CString CAdminMod::GetScope(const CUser* pUser)
+{
+	return pUser->GetUserName();
+}
+
+CString CAdminMod::GetScope(const CIRCNetwork* pNetwork)
+{
+	return pNetwork->GetUser()->GetUserName() + "/" + pNetwork->GetName();
+}
+
+CString CAdminMod::GetScope(const CChan* pChan)
+{
+	return GetScope(pChan->GetNetwork()) + "/" + pChan->GetName();
+}
+
+CString CAdminMod::GetAuditPath()
+{
+	// shared by all instances, appends from several admins interleave safely
+	return CZNC::Get().GetZNCPath() + "/admin-audit.log";
+}
+
+bool CAdminMod::IsMutating(const CString& sCmd)
+{
+	static const char* Prefixes[] = {
+		"Add", "Attach", "AutoDetach", "Clear", "Clone", "Connect", "Del", "Detach",
+		"Disconnect", "Import", "Inherit", "Join", "Jump", "Load", "Part", "PersistBuffers",
+		"Rehash", "Reload", "Restart", "Shutdown", "Snapshot", "Template", "Trim",
+		"Undo", "Unload", "Update"
+	};
+	for (const char* szPrefix : Prefixes) {
+		if (sCmd.StartsWith(szPrefix, CString::CaseInsensitive))
+			return true;
+	}
+	return false;
+}
+
+void CAdminMod::Audit(AuditKind eKind, const CString& sScope, const CString& sName, const CString& sOld, const CString& sNew)
+{
+	if (m_iAuditFD < 0) {
+		m_iAuditFD = open(GetAuditPath().c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+		if (m_iAuditFD < 0) {
+			DEBUG("admin: failed to open '" << GetAuditPath() << "': " << strerror(errno));
+			return;
+		}
+		AddTimer(new CAdminTimer(this, AuditSyncInterval, "auditsync", [this]() {
+			if (m_bAuditDirty)
+				fsync(m_iAuditFD);
+			m_bAuditDirty = false;
+			return true;
+		}));
+	}
+
+	const bool bSecret = sName.Equals("Password");
+
+	// <size> <time> <kind> <user> <scope> <name> <old> <new>, commands
+	// have their outcome as <old> and their arguments as <new>
+	CString sRecord;
+	AppendBinary(sRecord, uint32_t(0));
+	AppendBinary(sRecord, int64_t(time(nullptr)));
+	AppendBinary(sRecord, uint8_t(eKind));
+	AppendBinary(sRecord, GetUser()->GetUserName());
+	AppendBinary(sRecord, sScope);
+	AppendBinary(sRecord, sName);
+	AppendBinary(sRecord, bSecret ? CString("***") : sOld);
+	AppendBinary(sRecord, bSecret ? CString("***") : sNew);
+	const uint32_t uSize = sRecord.size();
+	memcpy(&sRecord[0], &uSize, sizeof(uSize));
+
+	// a single write() to an O_APPEND file lands in the page cache
+	// without waiting for the disk, the timer takes care of fsync()
+	if (write(m_iAuditFD, sRecord.data(), sRecord.size()) != (ssize_t) sRecord.size())
+		DEBUG("admin: failed to write '" << GetAuditPath() << "': " << strerror(errno));
+	m_bAuditDirty = true;
+}
+
+void CAdminMod::IndexAudit(const char* pData, size_t uSize)
+{
+	// only the part appended since the last search is scanned
+	CBufferReader Reader(pData, uSize, m_uAuditIndexed);
+	uint32_t uRecord;
+	int64_t iTime;
+	while (true) {
+		const size_t uOffset = Reader.Pos() - pData;
+		if (!Reader.Read(uRecord) || uRecord < sizeof(uRecord) + sizeof(iTime) || !Reader.Read(iTime) || !Reader.Skip(uRecord - sizeof(uRecord) - sizeof(iTime)))
+			break;
+		if (m_uAuditRecords++ % AuditIndexStep == 0)
+			m_vAuditIndex.push_back(std::make_pair(iTime, uOffset));
+		m_uAuditIndexed = uOffset + uRecord;
+	}
+}
+
+void CAdminMod::SearchAudit(const CString& sFilter, time_t tSince)
+{
+	// the records are read from the page cache, no need to wait for
+	// the disk, the timer takes care of fsync()
+	const int iFD = open(GetAuditPath().c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (iFD < 0 || fstat(iFD, &st) != 0 || st.st_size == 0) {
+		if (iFD >= 0)
+			close(iFD);
+		PutLine("No changes recorded");
+		return;
+	}
+
+	void* pMap = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, iFD, 0);
+	close(iFD);
+	if (pMap == MAP_FAILED) {
+		PutError("failed to read '" + GetAuditPath() + "'");
+		return;
+	}
+
+	const char* pData = static_cast<const char*>(pMap);
+	const size_t uSize = st.st_size;
+	if (uSize < m_uAuditIndexed) {
+		// truncated or rotated
+		m_vAuditIndex.clear();
+		m_uAuditIndexed = 0;
+		m_uAuditRecords = 0;
+	}
+	IndexAudit(pData, uSize);
+
+	// the log is in time order, start at the last indexed record before tSince
+	size_t uStart = 0;
+	auto it = std::lower_bound(m_vAuditIndex.begin(), m_vAuditIndex.end(), std::make_pair(int64_t(tSince), size_t(0)));
+	if (it != m_vAuditIndex.begin())
+		uStart = std::prev(it)->second;
+
+	std::deque<VCString> dRows;
+	unsigned long long uMatches = 0;
+	CBufferReader Reader(pData, m_uAuditIndexed, uStart);
+	uint32_t uRecord;
+	int64_t iTime;
+	uint8_t uKind;
+	CString sUser, sScope, sName, sOld, sNew;
+	while (Reader.Read(uRecord) && Reader.Read(iTime) && Reader.Read(uKind) && Reader.Read(sUser)
+			&& Reader.Read(sScope) && Reader.Read(sName) && Reader.Read(sOld) && Reader.Read(sNew)) {
+		if (iTime < tSince)
+			continue;
+		if (!sFilter.empty() && !sUser.WildCmp(sFilter, CString::CaseInsensitive)
+				&& !sScope.WildCmp(sFilter, CString::CaseInsensitive) && !sName.WildCmp(sFilter, CString::CaseInsensitive))
+			continue;
+
+		CString sAction;
+		if (uKind == AuditCommand)
+			sAction = sName + " " + sNew + (sOld.empty() ? "" : " (" + sOld + ")");
+		else
+			sAction = (uKind == AuditReset ? "Reset " : "Set ") + sName + ": "
+				+ sOld.Replace_n("\n", ", ") + " -> " + sNew.Replace_n("\n", ", ");
+
+		dRows.push_back({CUtils::FormatTime(iTime, "%Y-%m-%d %H:%M:%S", GetUser()->GetTimezone()), sUser, sScope.empty() ? CString("-") : sScope, sAction.Ellipsize(200)});
+		if (dRows.size() > AuditLines)
+			dRows.pop_front();
+		++uMatches;
+	}
+	munmap(pMap, uSize);
+
+	if (dRows.empty()) {
+		PutLine("No matching changes");
+		return;
+	}
+
+	CAdminTable Table(m_sArena, { "Time", "User", "Scope", "Change" });
+	Table.Reserve(dRows.size(), 96);
+	for (const VCString& vsRow : dRows) {
+		Table.AddRow();
+		Table.SetCell(0, vsRow[0]);
+		Table.SetCell(1, vsRow[1]);
+		Table.SetCell(2, vsRow[2]);
+		Table.SetCell(3, vsRow[3]);
+	}
+	PutTable(Table);
+	if (uMatches > dRows.size())
+		PutLine("Showing the latest " + CString(dRows.size()) + " of " + CString(uMatches) + " changes");
+}
+
+void CAdminMod::JournalValue(const CString& sScope, const CString& sVar, const CString& sOld)
+{
+	// the password getter does not return the hash, and the
+	// journal is per admin
+	if (sVar.Equals("Password") || !GetUser()->IsAdmin())
+		return;
+	m_vsUndoPending.push_back(sScope);
+	m_vsUndoPending.push_back(sVar);
+	m_vsUndoPending.push_back(sOld);
+}
+
+void CAdminMod::JournalCommand(const CString& sScope, const CString& sCmd, const CString& sArgs, const std::function<void()>& fnExec)
+{
+	// list-like settings are captured as a whole, added and deleted
+	// users and networks as the object
+	CString sVar, sChild;
+	if (sCmd.Equals("LoadMod") || sCmd.Equals("UnloadMod"))
+		sVar = "@modules";
+	else if (sCmd.Equals("AddPort") || sCmd.Equals("DelPort"))
+		sVar = "@ports";
+	else if (sCmd.Equals("AddServer") || sCmd.Equals("DelServer"))
+		sVar = "@servers";
+	else if (sCmd.Equals("AddUser") || sCmd.Equals("DelUser"))
+		sChild = sArgs.Token(0);
+	else if (sCmd.Equals("AddNetwork") || sCmd.Equals("DelNetwork"))
+		sChild = sScope + "/" + sArgs.Token(0);
+
+	if (!GetUser()->IsAdmin() || (sVar.empty() && sChild.empty())) {
+		fnExec();
+		return;
+	}
+
+	const CString sLabel = (sScope.empty() ? "" : sScope + ": ") + sCmd + " " + MaskSecretArgs(sCmd, sArgs);
+
+	if (!sVar.empty()) {
+		const CString sOld = GetConfigValue(sScope, sVar);
+		fnExec();
+		if (GetConfigValue(sScope, sVar) != sOld) {
+			JournalValue(sScope, sVar, sOld);
+			CommitUndo(sLabel);
+		}
+		return;
+	}
+
+	const bool bExisted = HasScope(sChild);
+	if (bExisted) {
+		CollectScope(sChild, [this](const CString& sVarScope, const CString& sName, const CString& sVal) {
+			m_vsUndoPending.push_back(sVarScope);
+			m_vsUndoPending.push_back(sName);
+			m_vsUndoPending.push_back(sVal);
+		});
+	}
+
+	fnExec();
+
+	const bool bExists = HasScope(sChild);
+	if (bExisted && !bExists) {
+		CommitUndo(sLabel, UndoRestore);
+	} else if (!bExisted && bExists) {
+		m_vsUndoPending.push_back(sChild);
+		CommitUndo(sLabel, UndoRemove);
+	} else {
+		m_vsUndoPending.clear();
+	}
+}
+
+void CAdminMod::CommitUndo(const CString& sLabel, UndoKind eKind)
+{
+	if (m_vsUndoPending.empty())
+		return;
+
+	// <label> <kind> <count> <string>...
+	CString sEntry;
+	AppendBinary(sEntry, sLabel);
+	AppendBinary(sEntry, uint8_t(eKind));
+	AppendBinary(sEntry, uint32_t(m_vsUndoPending.size()));
+	for (const CString& sValue : m_vsUndoPending)
+		AppendBinary(sEntry, sValue);
+	m_vsUndoPending.clear();
+
+	if (sEntry.size() > UndoBytes) {
+		PutLine("Note: the change is too large to be undone");
+		return;
+	}
+
+	m_uUndoBytes += sEntry.size();
+	m_dUndo.push_back(std::move(sEntry));
+	while (m_uUndoBytes > UndoBytes) {
+		m_uUndoBytes -= m_dUndo.front().size();
+		m_dUndo.pop_front();
+	}
+}
+
+void CAdminMod::Undo(unsigned int uCount)
+{
+	if (m_dUndo.empty()) {
+		PutError("nothing to undo");
+		return;
+	}
+
+	CZNC& ZNC = CZNC::Get();
+	unsigned int uUndone = 0;
+	VCString vsErrors;
+
+	// newest first, a restored object may be needed by older entries
+	for (; uUndone < uCount && !m_dUndo.empty(); ++uUndone) {
+		const CString sEntry = std::move(m_dUndo.back());
+		m_dUndo.pop_back();
+		m_uUndoBytes -= sEntry.size();
+
+		CBufferReader Reader(sEntry.data(), sEntry.size(), 0);
+		CString sLabel;
+		uint8_t uKind;
+		uint32_t uValues;
+		VCString vsValues;
+		if (!Reader.Read(sLabel) || !Reader.Read(uKind) || !Reader.Read(uValues))
+			continue;
+		vsValues.resize(uValues);
+		for (CString& sValue : vsValues)
+			Reader.Read(sValue);
+
+		if (uKind == UndoRemove) {
+			const CString sScope = vsValues.front();
+			CUser* pUser = ZNC.FindUser(sScope.Token(0, false, "/"));
+			const CString sNetwork = sScope.Token(1, true, "/");
+			if (!pUser)
+				vsErrors.push_back("unknown user '" + sScope.Token(0, false, "/") + "'");
+			else if (pUser == GetUser() && sNetwork.empty())
+				vsErrors.push_back("cannot delete yourself");
+			else if (sNetwork.empty() ? !ZNC.DeleteUser(pUser->GetUserName()) : !pUser->DeleteNetwork(sNetwork))
+				vsErrors.push_back("unable to delete '" + sScope + "'");
+			else
+				NotifyWatches(sScope, sNetwork.empty() ? "@user" : "@network");
+		} else {
+			for (size_t i = 0; i + 2 < vsValues.size(); i += 3) {
+				CString sError;
+				if (ApplyConfig(vsValues[i], vsValues[i + 1], vsValues[i + 2], uKind == UndoRestore, sError) == ApplyFailed)
+					vsErrors.push_back(sError);
+			}
+		}
+		PutLine("Undid " + sLabel);
+	}
+
+	for (const CString& sError : vsErrors)
+		PutError(sError);
+
+	if (!ZNC.WriteConfig())
+		PutError("failed to write '" + ZNC.GetConfigFile() + "'");
+	else
+		PutSuccess(CString(uUndone) + " changes undone");
+}
+
+void CAdminMod::CollectScope(const CString& sScope, const ConfigVisitor& Visitor) const
+{
+	if (sScope.empty()) {
+		CollectGlobalConfig(Visitor);
+		return;
+	}
+
+	const CUser* pUser = CZNC::Get().FindUser(sScope.Token(0, false, "/"));
+	if (!pUser)
+		return;
+
+	CollectUserConfig(pUser, [&](const CString& sVarScope, const CString& sVar, const CString& sVal) {
+		if (sVarScope.Equals(sScope) || sVarScope.StartsWith(sScope + "/", CString::CaseInsensitive))
+			Visitor(sVarScope, sVar, sVal);
+	});
+}
+
+CString CAdminMod::GetConfigValue(const CString& sScope, const CString& sVar) const
+{
+	CString sValue;
+	CollectScope(sScope, [&](const CString& sVarScope, const CString& sName, const CString& sVal) {
+		if (sVarScope.Equals(sScope) && sName.Equals(sVar))
+			sValue = sVal;
+	});
+	return sValue;
+}
+
+bool CAdminMod::HasScope(const CString& sScope)
+{
+	const CUser* pUser = CZNC::Get().FindUser(sScope.Token(0, false, "/"));
+	const CString sNetwork = sScope.Token(1, false, "/");
+	return pUser && (sNetwork.empty() || pUser->FindNetwork(sNetwork));
+}
+
+bool CAdminMod::OnWebPreRequest(CWebSock& WebSock, const CString& sPageName)
+{
+	if (sPageName == "metrics") {
+		if (!GetUser()->IsAdmin()) {
+			WebSock.PrintErrorPage(403, "Forbidden", "Admin privileges required");
+			return true;
+		}
+		if (m_sMetrics.empty() || time(nullptr) - m_tMetrics >= MetricsTTL) {
+			RenderMetrics(m_sMetrics);
+			m_tMetrics = time(nullptr);
+		}
+		WebSock.PrintHeader(m_sMetrics.size(), "text/plain; version=0.0.4");
+		WebSock.Write(m_sMetrics);
+		WebSock.Close(Csock::CLT_AFTERWRITE);
+		return true;
+	}
+
+	if (sPageName != "api")
+		return false;
+
+	// GET  api?scope=<scope>[&scope=...][&var=<variable>...]
+	// POST api with set=<scope> <variable> <value>[&set=...]
+	// where scope is - for global settings, and includes the child
+	// scopes; variables may contain wildcards
+	CString sJSON;
+	if (WebSock.IsPost()) {
+		VCString vsValues;
+		WebSock.GetParamValues("set", vsValues, true);
+		SetConfigJSON(vsValues, sJSON);
+	} else {
+		VCString vsScopes, vsVars;
+		WebSock.GetParamValues("scope", vsScopes, false);
+		WebSock.GetParamValues("var", vsVars, false);
+		if (vsScopes.empty())
+			vsScopes.push_back(GetUser()->GetUserName());
+		GetConfigJSON(vsScopes, vsVars, sJSON);
+	}
+
+	WebSock.PrintHeader(sJSON.size(), "application/json");
+	WebSock.Write(sJSON);
+	WebSock.Close(Csock::CLT_AFTERWRITE);
+	return true;
+}
+
+void CAdminMod::EstimateMemory(std::vector<std::pair<CString, size_t>>& vParts)
+{
+	// the instance itself includes the tables, histogram and fixed members
+	vParts.emplace_back("Tables", sizeof(CAdminMod) + EstimateSize(GlobalVars) + EstimateSize(UserVars) + EstimateSize(NetworkVars)
+		+ EstimateSize(ChanVars) + EstimateSize(GlobalCmds) + EstimateSize(UserCmds) + EstimateSize(NetworkCmds) + EstimateSize(ChanCmds));
+
+	size_t uSnapshots = m_Pool.Memory() + m_mSnapshots.size() * (sizeof(std::pair<const CString, ConfigSnapshot>) + NodeOverhead);
+	for (const auto& it : m_mSnapshots)
+		uSnapshots += EstimateSize(it.first) + it.second.records.capacity() * sizeof(ConfigRecord);
+	size_t uWatches = m_mWatches.size() * (sizeof(std::pair<const CString, WatchInfo>) + NodeOverhead);
+	for (const auto& it : m_mWatches)
+		uWatches += EstimateSize(it.first) + EstimateSize(it.second.items) + EstimateSize(it.second.state) + EstimateSize(it.second.queue);
+	vParts.emplace_back("Config", uSnapshots + uWatches);
+
+	vParts.emplace_back("Caches", EstimateSize(m_mChanActivity) + EstimateSize(m_mAutoDetached) + EstimateSize(m_mListenerStats)
+		+ EstimateSize(m_mListenerOptions) + EstimateSize(m_sMetrics) + EstimateSize(m_sScratch));
+
+	vParts.emplace_back("Journal", m_uUndoBytes + m_dUndo.size() * sizeof(CString) + EstimateSize(m_vsUndoPending)
+		+ EstimateSize(m_vAuditIndex));
+
+	// the history is shared, see EstimateSharedMemory()
+	vParts.emplace_back("History", 0);
+
+	size_t uNV = 0;
+	for (MCString::iterator it = BeginNV(); it != EndNV(); ++it)
+		uNV += sizeof(*it) + NodeOverhead + EstimateSize(it->first) + EstimateSize(it->second);
+	vParts.emplace_back("NV", uNV);
+
+	vParts.emplace_back("Output", m_pControl ? sizeof(CAdminControl) + m_pControl->GetPendingBytes() : 0);
 }
 
-void CAdminMod::SetInfix(const CString& sInfix)
+void CAdminMod::EstimateSharedMemory(std::vector<std::pair<CString, size_t>>& vParts) const
 {
-	SetNV("infix", sInfix);
+	for (auto& Part : vParts) {
+		if (Part.first == "Config")
+			Part.second += EstimateSize(m_Shared.templates) + EstimateSize(m_Shared.inherits)
+				+ EstimateSize(m_Shared.inheritors) + EstimateSize(m_Shared.localVars);
+		else if (Part.first == "Caches")
+			Part.second += EstimateSize(m_Shared.buffers.offsets);
+		else if (Part.first == "History")
+			Part.second += m_Shared.history.size() * (sizeof(HistorySeries) + sizeof(std::pair<const CString, std::unique_ptr<HistorySeries>>) + NodeOverhead);
+		else if (Part.first == "NV")
+			Part.second += EstimateSize(m_Shared.registry);
+	}
 }
 
-void CAdminMod::OnModCommand(const CString& sLine)
+void CAdminMod::ShowMemory()
 {
-	const CString sCmd = sLine.Token(0);
+	// estimated from the sizes and capacities of the members, memory
+	// mapped files (buffers, audit log, history) are not included
+	std::vector<std::pair<CString, size_t>> vTotal;
+	EstimateMemory(vTotal);
+
+	// every instance reports the same parts, this one names the columns
+	std::vector<const char*> vColumns = { "User" };
+	for (auto& Part : vTotal) {
+		vColumns.push_back(Part.first.c_str());
+		Part.second = 0;
+	}
+	vColumns.push_back("Total");
+	CAdminTable Table(m_sArena, vColumns);
+	const size_t uTotalColumn = vColumns.size() - 1;
+	Table.Reserve(CZNC::Get().GetUserMap().size() + 2, vColumns.size() * 10);
 
-	m_sTarget = GetModName();
+	for (const auto& it : CZNC::Get().GetUserMap()) {
+		CAdminMod* pMod = dynamic_cast<CAdminMod*>(it.second->GetModules().FindModule(GetModName()));
+		if (!pMod)
+			continue;
 
-	if (!GetUser()->IsAdmin() && !sCmd.Equals("Help") && !sCmd.Equals("Get") && !sCmd.Equals("List")) {
-		PutError("access denied.");
-		return;
+		std::vector<std::pair<CString, size_t>> vParts;
+		pMod->EstimateMemory(vParts);
+
+		size_t uSum = 0;
+		Table.AddRow();
+		Table.SetCell(0, it.first);
+		for (size_t i = 0; i < vParts.size(); ++i) {
+			Table.SetCell(i + 1, CString::ToByteStr(vParts[i].second));
+			vTotal[i].second += vParts[i].second;
+			uSum += vParts[i].second;
+		}
+		Table.SetCell(uTotalColumn, CString::ToByteStr(uSum));
 	}
 
-	if (sCmd.Equals("Help")) {
-		const CString sFilter = sLine.Token(1);
+	// the state shared by all instances is counted once
+	std::vector<std::pair<CString, size_t>> vShared = vTotal;
+	for (auto& Part : vShared)
+		Part.second = 0;
+	EstimateSharedMemory(vShared);
+
+	size_t uSum = 0;
+	Table.AddRow();
+	Table.SetCell(0, "(shared)");
+	for (size_t i = 0; i < vShared.size(); ++i) {
+		Table.SetCell(i + 1, CString::ToByteStr(vShared[i].second));
+		vTotal[i].second += vShared[i].second;
+		uSum += vShared[i].second;
+	}
+	Table.SetCell(uTotalColumn, CString::ToByteStr(uSum));
+
+	uSum = 0;
+	Table.AddRow();
+	Table.SetCell(0, "(total)");
+	for (size_t i = 0; i < vTotal.size(); ++i) {
+		Table.SetCell(i + 1, CString::ToByteStr(vTotal[i].second));
+		uSum += vTotal[i].second;
+	}
+	Table.SetCell(uTotalColumn, CString::ToByteStr(uSum));
+	PutTable(Table);
+}
 
-		const CTable Table = FilterCmdTable(GlobalCmds, sFilter);
-		if (!Table.empty())
-			PutModule(Table);
-		else if (!sFilter.empty())
-			PutModule("No matches for '" + sFilter + "'");
+void CAdminMod::RenderMetrics(CString& sOut) const
+{
+	// clear() keeps the capacity of the previous render
+	sOut.clear();
 
-		const CString sPfx = GetUser()->GetStatusPrefix() + GetInfix();
+	auto fnLabel = [](const CString& sValue) {
+		return sValue.Replace_n("\\", "\\\\").Replace_n("\"", "\\\"").Replace_n("\n", "\\n");
+	};
+	auto fnHeader = [&](const char* szName, const char* szType, const char* szHelp) {
+		sOut += CString("# HELP ") + szName + " " + szHelp + "\n# TYPE " + szName + " " + szType + "\n";
+	};
 
-		if (sFilter.empty()) {
-			PutModule("To access settings of the current user or network, open a query");
-			PutModule("with " + sPfx + "user or " + sPfx + "network, respectively.");
-			PutModule("-----");
-			PutModule("- user settings: /msg " + sPfx + "user help");
-			PutModule("- network settings: /msg " + sPfx + "network help");
-			PutModule("-----");
-			PutModule("To access settings of a different user (admins only) or a specific");
-			PutModule("network, open a query with " + sPfx + "target, where target is the name of");
-			PutModule("the user or network. The same applies to channel specific settings.");
-			PutModule("-----");
-			PutModule("- user settings: /msg " + sPfx + "somebody help");
-			PutModule("- network settings: /msg " + sPfx + "freenode help");
-			PutModule("- channel settings: /msg " + sPfx + "#znc help");
-			PutModule("-----");
-			PutModule("It is also possible to access the network settings of a different");
-			PutModule("user (admins only), or the channel settings of a different network.");
-			PutModule("Combine a user, network and channel name separated by a forward");
-			PutModule("slash ('/') character.");
-			PutModule("-----");
-			PutModule("Advanced examples:");
-			PutModule("- network settings of another user: /msg " + sPfx + "somebody/freenode help");
-			PutModule("- channel settings of another network: /msg " + sPfx + "freenode/#znc help");
-			PutModule("- channel settings of another network of another user: /msg " + sPfx + "somebody/freenode/#znc help");
+	const CZNC& ZNC = CZNC::Get();
+	unsigned int uNetworks[2] = {0, 0};
+	unsigned long long uClients = 0, uChans = 0;
+	// samples of a metric must not be interleaved with other metrics
+	CString sUserRead, sUserWritten, sNetworkRead, sNetworkWritten, sBuffers;
+
+	for (const auto& it : ZNC.GetUserMap()) {
+		const CUser* pUser = it.second;
+		const CString sUser = fnLabel(it.first);
+		uClients += pUser->GetAllClients().size();
+		sUserRead += "znc_user_bytes_read_total{user=\"" + sUser + "\"} " + CString(pUser->BytesRead()) + "\n";
+		sUserWritten += "znc_user_bytes_written_total{user=\"" + sUser + "\"} " + CString(pUser->BytesWritten()) + "\n";
+
+		for (const CIRCNetwork* pNetwork : pUser->GetNetworks()) {
+			const CString sLabels = "{user=\"" + sUser + "\",network=\"" + fnLabel(pNetwork->GetName()) + "\"}";
+			++uNetworks[pNetwork->IsIRCConnected() ? 1 : 0];
+			uChans += pNetwork->GetChans().size();
+			sNetworkRead += "znc_network_bytes_read_total" + sLabels + " " + CString(pNetwork->BytesRead()) + "\n";
+			sNetworkWritten += "znc_network_bytes_written_total" + sLabels + " " + CString(pNetwork->BytesWritten()) + "\n";
+
+			unsigned long long uLines = 0;
+			for (const CChan* pChan : pNetwork->GetChans())
+				uLines += pChan->GetBuffer().Size();
+			for (const CQuery* pQuery : pNetwork->GetQueries())
+				uLines += pQuery->GetBuffer().Size();
+			sBuffers += "znc_buffer_lines" + sLabels + " " + CString(uLines) + "\n";
 		}
-	} else if (sCmd.Equals("List")) {
-		OnListCommand(&CZNC::Get(), sLine, GlobalVars);
-	} else if (sCmd.Equals("Get")) {
-		OnGetCommand(&CZNC::Get(), sLine, GlobalVars);
-	} else if (sCmd.Equals("Set")) {
-		OnSetCommand(&CZNC::Get(), sLine, GlobalVars);
-	} else if (sCmd.Equals("Reset")) {
-		OnResetCommand(&CZNC::Get(), sLine, GlobalVars);
-	} else {
-		OnExecCommand(&CZNC::Get(), sLine, GlobalCmds);
 	}
+
+	fnHeader("znc_users", "gauge", "Number of users.");
+	sOut += "znc_users " + CString(ZNC.GetUserMap().size()) + "\n";
+	fnHeader("znc_networks", "gauge", "Number of networks.");
+	sOut += "znc_networks{connected=\"false\"} " + CString(uNetworks[0]) + "\n";
+	sOut += "znc_networks{connected=\"true\"} " + CString(uNetworks[1]) + "\n";
+	fnHeader("znc_clients", "gauge", "Number of attached clients.");
+	sOut += "znc_clients " + CString(uClients) + "\n";
+	fnHeader("znc_channels", "gauge", "Number of channels.");
+	sOut += "znc_channels " + CString(uChans) + "\n";
+	fnHeader("znc_user_bytes_read_total", "counter", "Bytes read per user.");
+	sOut += sUserRead;
+	fnHeader("znc_user_bytes_written_total", "counter", "Bytes written per user.");
+	sOut += sUserWritten;
+	fnHeader("znc_network_bytes_read_total", "counter", "Bytes read per network.");
+	sOut += sNetworkRead;
+	fnHeader("znc_network_bytes_written_total", "counter", "Bytes written per network.");
+	sOut += sNetworkWritten;
+	fnHeader("znc_buffer_lines", "gauge", "Channel and query playback buffer lines per network.");
+	sOut += sBuffers;
+
+	fnHeader("znc_listener_accepts_total", "counter", "Connections accepted per listener since the module was loaded.");
+	for (const CListener* pListener : ZNC.GetListeners()) {
+		auto it = m_mListenerStats.find(pListener);
+		sOut += "znc_listener_accepts_total{port=\"" + CString(pListener->GetPort()) + "\",bindhost=\"" + fnLabel(pListener->GetBindHost())
+			+ "\"} " + CString(it != m_mListenerStats.end() ? it->second.accepted : 0) + "\n";
+	}
+
+	fnHeader("znc_admin_command_seconds", "histogram", "Latency of admin commands run by this user.");
+	unsigned long long uCumulative = 0;
+	for (size_t i = 0; i < LatencyBuckets; ++i) {
+		uCumulative += m_Latency.buckets[i];
+		sOut += "znc_admin_command_seconds_bucket{le=\"" + CString(LatencyBounds[i], 4) + "\"} " + CString(uCumulative) + "\n";
+	}
+	sOut += "znc_admin_command_seconds_bucket{le=\"+Inf\"} " + CString(m_Latency.count) + "\n";
+	sOut += "znc_admin_command_seconds_sum " + CString(m_Latency.sum, 6) + "\n";
+	sOut += "znc_admin_command_seconds_count " + CString(m_Latency.count) + "\n";
 }
 
-CModule::EModRet CAdminMod::OnUserRaw(CString& sLine)
+unsigned long long CAdminMod::EstimateBufferBytes(const CBuffer& Buffer)
 {
-	CString sCopy = sLine;
-	if (sCopy.StartsWith("@"))
-		sCopy = sCopy.Token(1, true);
-	if (sCopy.StartsWith(":"))
-		sCopy = sCopy.Token(1, true);
+	// samples a few lines instead of walking every line of every buffer
+	const size_t uLines = Buffer.Size();
+	if (uLines == 0)
+		return 0;
+	const size_t uStep = std::max<size_t>(1, uLines / 8);
+	unsigned long long uSampled = 0, uSamples = 0;
+	for (size_t i = 0; i < uLines; i += uStep, ++uSamples) {
+		const CBufLine& Line = Buffer.GetBufLine(i);
+		uSampled += Line.GetFormat().capacity() + Line.GetText().capacity();
+	}
+	return uLines * (sizeof(CBufLine) + uSampled / uSamples);
+}
 
-	const CString sCmd = sCopy.Token(0);
+void CAdminMod::SampleHistory()
+{
+	// armed first, a reload within the same minute must not stop sampling
+	if (!FindTimer("history")) {
+		AddTimer(new CAdminTimer(this, 60, "history", [this]() {
+			if (!GetSharedNV("history").ToBool())
+				return false;
+			SampleHistory();
+			return true;
+		}));
+	}
 
-	if (sCmd.Equals("ZNC") || sCmd.Equals("PRIVMSG")) {
-		CString sTarget = sCopy.Token(1);
-		if (sTarget.TrimPrefix(GetUser()->GetStatusPrefix() + GetInfix())) {
-			const CString sRest = sCopy.Token(2, true).TrimPrefix_n(":");
-			const CString sPfx = GetInfix();
+	const time_t tNow = time(nullptr) / 60 * 60;
+	if (m_Shared.historyTime) {
+		if (tNow <= m_Shared.historyTime)
+			return;
+		// minutes without samples (ZNC was down) stay empty
+		const time_t tMinutes = std::min<time_t>((tNow - m_Shared.historyTime) / 60, HistorySlots);
+		for (time_t i = 0; i < tMinutes; ++i) {
+			m_Shared.historyPos = (m_Shared.historyPos + 1) % HistorySlots;
+			for (auto& it : m_Shared.history) {
+				for (unsigned int uMetric = 0; uMetric < HistoryMetricCount; ++uMetric)
+					it.second->Set(uMetric, m_Shared.historyPos, 0);
+			}
+		}
+	}
+	m_Shared.historyTime = tNow;
+
+	std::set<CString> ssSeen;
+	auto fnSample = [&](const CString& sKey, unsigned long long uTotal, size_t uClients, size_t uNetworks, unsigned long long uBuffer) {
+		std::unique_ptr<HistorySeries>& pSeries = m_Shared.history[sKey];
+		if (!pSeries) {
+			pSeries.reset(new HistorySeries);
+			pSeries->total = uTotal;
+		}
+		// the counters restart from zero when ZNC restarts
+		const unsigned long long uDelta = uTotal >= pSeries->total ? uTotal - pSeries->total : uTotal;
+		pSeries->total = uTotal;
+		pSeries->Set(HistoryTraffic, m_Shared.historyPos, std::min<unsigned long long>(uDelta, UINT32_MAX));
+		pSeries->Set(HistoryClients, m_Shared.historyPos, uClients);
+		pSeries->Set(HistoryNetworks, m_Shared.historyPos, uNetworks);
+		pSeries->Set(HistoryBuffer, m_Shared.historyPos, std::min<unsigned long long>(uBuffer / 1024, UINT32_MAX));
+		ssSeen.insert(sKey);
+	};
 
-			m_sTarget = GetInfix() + sTarget;
+	unsigned long long uAllTotal = 0, uAllBuffer = 0;
+	size_t uAllClients = 0, uAllNetworks = 0;
+	for (const auto& it : CZNC::Get().GetUserMap()) {
+		const CUser* pUser = it.second;
+		unsigned long long uUserBuffer = 0;
+		size_t uConnected = 0;
+		for (const CIRCNetwork* pNetwork : pUser->GetNetworks()) {
+			unsigned long long uBuffer = 0;
+			for (const CChan* pChan : pNetwork->GetChans())
+				uBuffer += EstimateBufferBytes(pChan->GetBuffer());
+			for (const CQuery* pQuery : pNetwork->GetQueries())
+				uBuffer += EstimateBufferBytes(pQuery->GetBuffer());
+			fnSample(it.first + "/" + pNetwork->GetName(), pNetwork->BytesRead() + pNetwork->BytesWritten(),
+				pNetwork->GetClients().size(), pNetwork->IsIRCConnected(), uBuffer);
+			uUserBuffer += uBuffer;
+			uConnected += pNetwork->IsIRCConnected();
+		}
+		const unsigned long long uTotal = pUser->BytesRead() + pUser->BytesWritten();
+		const size_t uClients = pUser->GetAllClients().size();
+		fnSample(it.first, uTotal, uClients, uConnected, uUserBuffer);
+		uAllTotal += uTotal;
+		uAllBuffer += uUserBuffer;
+		uAllClients += uClients;
+		uAllNetworks += uConnected;
+	}
+	fnSample("*", uAllTotal, uAllClients, uAllNetworks, uAllBuffer);
+
+	// deleted users and networks
+	for (auto it = m_Shared.history.begin(); it != m_Shared.history.end();) {
+		if (ssSeen.count(it->first))
+			++it;
+		else
+			it = m_Shared.history.erase(it);
+	}
+
+	if (tNow / 60 % HistorySaveInterval == 0)
+		SaveHistory();
+}
 
-			// <user>
-			if (sTarget.Equals("user"))
-				return OnUserCommand(GetUser(), sRest);
-			if (CUser* pUser = CZNC::Get().FindUser(sTarget))
-				return OnUserCommand(pUser, sRest);
+void CAdminMod::SaveHistory()
+{
+	// <magic> <time> <pos> <count> { <key> <total> { <varint delta>... } per metric }...
+	// each metric is stored oldest first as zigzag encoded deltas, which
+	// keeps mostly flat series at a byte per sample
+	CString sOut("ZNCHIS01");
+	AppendBinary(sOut, int64_t(m_Shared.historyTime));
+	AppendBinary(sOut, uint32_t(m_Shared.historyPos));
+	AppendBinary(sOut, uint32_t(m_Shared.history.size()));
+	for (const auto& it : m_Shared.history) {
+		AppendBinary(sOut, it.first);
+		AppendBinary(sOut, uint64_t(it.second->total));
+		for (unsigned int uMetric = 0; uMetric < HistoryMetricCount; ++uMetric) {
+			int64_t iPrev = 0;
+			for (size_t i = 1; i <= HistorySlots; ++i) {
+				const int64_t iValue = it.second->Get(uMetric, (m_Shared.historyPos + i) % HistorySlots);
+				const int64_t iDelta = iValue - iPrev;
+				AppendVarint(sOut, (uint64_t(iDelta) << 1) ^ uint64_t(iDelta >> 63));
+				iPrev = iValue;
+			}
+		}
+	}
 
-			// <network>
-			if (sTarget.Equals("network") && GetNetwork())
-				return OnNetworkCommand(GetNetwork(), sRest);
-			if (CIRCNetwork* pNetwork = GetUser()->FindNetwork(sTarget))
-				return OnNetworkCommand(pNetwork, sRest);
+	// replaced by a rename so that a crash never leaves a torn file, not
+	// synced since it is saved periodically from the event loop
+	const CString sFile = CZNC::Get().GetZNCPath() + "/admin.history";
+	CFile File(sFile + ".tmp");
+	bool bOk = File.Open(O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	bOk = bOk && File.Write(sOut) == (ssize_t) sOut.size();
+	File.Close();
+	if (!bOk || !CFile::Move(sFile + ".tmp", sFile, true)) {
+		CFile::Delete(sFile + ".tmp");
+		DEBUG("admin: failed to write '" << sFile << "'");
+		return;
+	}
+	m_Shared.historySaved = m_Shared.historyTime;
+}
 
-			// <#chan>
-			if (CChan* pChan = GetNetwork() ? GetNetwork()->FindChan(sTarget) : nullptr)
-				return OnChanCommand(pChan, sRest);
+void CAdminMod::LoadHistory()
+{
+	if (m_Shared.historyTime)
+		return;
 
-			VCString vsParts;
-			sTarget.Split("/", vsParts, false);
-			if (vsParts.size() == 2) {
-				// <user/network>
-				if (CUser* pUser = CZNC::Get().FindUser(vsParts[0])) {
-					if (CIRCNetwork* pNetwork = pUser->FindNetwork(vsParts[1])) {
-						return OnNetworkCommand(pNetwork, sRest);
-					} else {
-						// <user/#chan>
-						if (pUser == GetUser()) {
-							if (CIRCNetwork* pUserNetwork = GetNetwork()) {
-								if (CChan* pChan = pUserNetwork->FindChan(vsParts[1]))
-									return OnChanCommand(pChan, sRest);
-							}
-						}
-						if (pUser->GetNetworks().size() == 1) {
-							if (CIRCNetwork* pFirstNetwork = pUser->GetNetworks().front()) {
-								if (CChan* pChan = pFirstNetwork->FindChan(vsParts[1]))
-									return OnChanCommand(pChan, sRest);
-							}
-						}
-					}
-					PutError("unknown (or ambiguous) network or channel");
-					return HALT;
-				}
-				// <network/#chan>
-				if (CIRCNetwork* pNetwork = GetUser()->FindNetwork(vsParts[0])) {
-					if (CChan* pChan = pNetwork->FindChan(vsParts[1])) {
-						return OnChanCommand(pChan, sRest);
-					} else {
-						PutError("unknown channel");
-						return HALT;
-					}
-				}
-			} else if (vsParts.size() == 3) {
-				// <user/network/#chan>
-				if (CUser* pUser = CZNC::Get().FindUser(vsParts[0])) {
-					if (CIRCNetwork* pNetwork = pUser->FindNetwork(vsParts[1])) {
-						if (CChan* pChan = pNetwork->FindChan(vsParts[2])) {
-							return OnChanCommand(pChan, sRest);
-						} else {
-							PutError("unknown channel");
-							return HALT;
-						}
-					} else {
-						PutError("unknown network");
-						return HALT;
-					}
+	const CString sFile = CZNC::Get().GetZNCPath() + "/admin.history";
+	const int iFD = open(sFile.c_str(), O_RDONLY | O_CLOEXEC);
+	if (iFD < 0)
+		return;
+	struct stat st;
+	void* pMap = MAP_FAILED;
+	if (fstat(iFD, &st) == 0 && st.st_size > 8)
+		pMap = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, iFD, 0);
+	close(iFD);
+	if (pMap == MAP_FAILED)
+		return;
+
+	const char* pData = static_cast<const char*>(pMap);
+	CBufferReader Reader(pData, st.st_size, 8);
+	int64_t iTime;
+	uint32_t uPos, uCount;
+	if (memcmp(pData, "ZNCHIS01", 8) == 0 && Reader.Read(iTime) && Reader.Read(uPos) && Reader.Read(uCount) && uPos < HistorySlots) {
+		m_Shared.historyTime = iTime;
+		m_Shared.historySaved = iTime;
+		m_Shared.historyPos = uPos;
+		CString sKey;
+		uint64_t uTotal, uZigzag;
+		for (uint32_t n = 0; n < uCount && Reader.Read(sKey) && Reader.Read(uTotal); ++n) {
+			std::unique_ptr<HistorySeries> pSeries(new HistorySeries);
+			pSeries->total = uTotal;
+			bool bOk = true;
+			for (unsigned int uMetric = 0; uMetric < HistoryMetricCount && bOk; ++uMetric) {
+				int64_t iValue = 0;
+				for (size_t i = 1; i <= HistorySlots && bOk; ++i) {
+					bOk = Reader.ReadVarint(uZigzag);
+					iValue += int64_t(uZigzag >> 1) ^ -int64_t(uZigzag & 1);
+					pSeries->Set(uMetric, (m_Shared.historyPos + i) % HistorySlots, uint32_t(iValue));
 				}
 			}
+			if (!bOk)
+				break;
+			m_Shared.history[sKey] = std::move(pSeries);
 		}
 	}
-	return CONTINUE;
+	munmap(pMap, st.st_size);
 }
 
-CModule::EModRet CAdminMod::OnUserCommand(CUser* pUser, const CString& sLine)
+CString CAdminMod::GetSparkline(const HistorySeries& Series, unsigned int uMetric, unsigned long long& uMax, unsigned long long& uSum) const
 {
-	const CString sCmd = sLine.Token(0);
-
-	if (pUser != GetUser() && !GetUser()->IsAdmin()) {
-		PutError("access denied");
-		return HALT;
+	// 48 columns of 30 minutes, traffic is summed and the rest is the maximum
+	static const char* Blocks[] = { "\xe2\x96\x81", "\xe2\x96\x82", "\xe2\x96\x83", "\xe2\x96\x84",
+		"\xe2\x96\x85", "\xe2\x96\x86", "\xe2\x96\x87", "\xe2\x96\x88" };
+	static const size_t Columns = 48;
+	const size_t uPerColumn = HistorySlots / Columns;
+
+	unsigned long long aColumns[Columns] = {};
+	uMax = 0;
+	uSum = 0;
+	for (size_t i = 0; i < HistorySlots; ++i) {
+		const uint32_t uValue = Series.Get(uMetric, (m_Shared.historyPos + 1 + i) % HistorySlots);
+		unsigned long long& uColumn = aColumns[i / uPerColumn];
+		uColumn = uMetric == HistoryTraffic ? uColumn + uValue : std::max<unsigned long long>(uColumn, uValue);
+		uSum += uValue;
 	}
+	for (unsigned long long uColumn : aColumns)
+		uMax = std::max(uMax, uColumn);
 
-	if (sCmd.Equals("Help"))
-		OnHelpCommand(sLine, UserCmds);
-	else if (sCmd.Equals("List"))
-		OnListCommand(pUser, sLine, UserVars);
-	else if (sCmd.Equals("Get"))
-		OnGetCommand(pUser, sLine, UserVars);
-	else if (sCmd.Equals("Set"))
-		OnSetCommand(pUser, sLine, UserVars);
-	else if (sCmd.Equals("Reset"))
-		OnResetCommand(pUser, sLine, UserVars);
-	else
-		OnExecCommand(pUser, sLine, UserCmds);
-
-	return HALT;
+	CString sLine;
+	for (unsigned long long uColumn : aColumns)
+		sLine += uMax ? Blocks[uColumn * 7 / uMax] : Blocks[0];
+	return sLine;
 }
 
-CModule::EModRet CAdminMod::OnNetworkCommand(CIRCNetwork* pNetwork, const CString& sLine)
+void CAdminMod::ShowHistory(const CString& sMetric, const CString& sKey, bool bTable)
 {
-	const CString sCmd = sLine.Token(0);
+	const char** pName = std::find_if(std::begin(HistoryNames), std::end(HistoryNames), [&](const char* szName) {
+		return sMetric.Equals(szName);
+	});
+	if (pName == std::end(HistoryNames)) {
+		PutError("unknown metric '" + sMetric + "'");
+		return;
+	}
+	const unsigned int uMetric = pName - std::begin(HistoryNames);
 
-	if (pNetwork->GetUser() != GetUser() && !GetUser()->IsAdmin()) {
-		PutError("access denied");
-		return HALT;
+	if (!m_Shared.historyTime) {
+		PutError("history is off");
+		return;
+	}
+	auto it = m_Shared.history.find(sKey);
+	if (it == m_Shared.history.end()) {
+		PutError("no history of '" + sKey + "'");
+		return;
 	}
+	const HistorySeries& Series = *it->second;
+	auto fnFormat = [&](unsigned long long uValue) {
+		if (uMetric == HistoryTraffic)
+			return CString::ToByteStr(uValue);
+		if (uMetric == HistoryBuffer)
+			return CString::ToByteStr(uValue * 1024);
+		return CString(uValue);
+	};
 
-	if (sCmd.Equals("Help"))
-		OnHelpCommand(sLine, NetworkCmds);
-	else if (sCmd.Equals("List"))
-		OnListCommand(pNetwork, sLine, NetworkVars);
-	else if (sCmd.Equals("Get"))
-		OnGetCommand(pNetwork, sLine, NetworkVars);
-	else if (sCmd.Equals("Set"))
-		OnSetCommand(pNetwork, sLine, NetworkVars);
-	else if (sCmd.Equals("Reset"))
-		OnResetCommand(pNetwork, sLine, NetworkVars);
-	else
-		OnExecCommand(pNetwork, sLine, NetworkCmds);
+	if (!bTable) {
+		unsigned long long uMax, uSum;
+		const CString sSpark = GetSparkline(Series, uMetric, uMax, uSum);
+		PutLine(sKey + " " + HistoryNames[uMetric] + " (24h, 30 min per column)");
+		PutLine(sSpark);
+		const uint32_t uLatest = Series.Get(uMetric, m_Shared.historyPos);
+		PutLine(uMetric == HistoryTraffic ? "total " + fnFormat(uSum) + ", peak " + fnFormat(uMax) + "/30min, last minute " + fnFormat(uLatest)
+				: "peak " + fnFormat(uMax) + ", now " + fnFormat(uLatest));
+		return;
+	}
 
-	return HALT;
+	// one row per hour, oldest first
+	std::vector<const char*> vColumns = { "Hour", "Min", "Avg", "Max" };
+	if (uMetric == HistoryTraffic)
+		vColumns.push_back("Total");
+	CAdminTable Table(m_sArena, vColumns);
+	Table.Reserve(24, 48);
+	for (size_t uHour = 0; uHour < 24; ++uHour) {
+		unsigned long long uMin = ULLONG_MAX, uMax = 0, uSum = 0;
+		for (size_t i = 0; i < 60; ++i) {
+			const uint32_t uValue = Series.Get(uMetric, (m_Shared.historyPos + 1 + uHour * 60 + i) % HistorySlots);
+			uMin = std::min<unsigned long long>(uMin, uValue);
+			uMax = std::max<unsigned long long>(uMax, uValue);
+			uSum += uValue;
+		}
+		const time_t tHour = m_Shared.historyTime - (23 - uHour) * 60 * 60 - 59 * 60;
+		Table.AddRow();
+		Table.SetCell(0, CUtils::FormatTime(tHour, "%H:%M", GetUser()->GetTimezone()));
+		Table.SetCell(1, fnFormat(uMin));
+		Table.SetCell(2, fnFormat(uSum / 60));
+		Table.SetCell(3, fnFormat(uMax));
+		if (uMetric == HistoryTraffic)
+			Table.SetCell(4, fnFormat(uSum));
+	}
+	PutTable(Table);
 }
 
-CModule::EModRet CAdminMod::OnChanCommand(CChan* pChan, const CString& sLine)
+void CAdminMod::ShowTrafficHistory()
 {
-	const CString sCmd = sLine.Token(0);
-
-	if (pChan->GetNetwork()->GetUser() != GetUser() && !GetUser()->IsAdmin()) {
-		PutError("access denied");
-		return HALT;
+	if (!m_Shared.historyTime) {
+		PutError("history is off, see History on");
+		return;
 	}
 
-	if (sCmd.Equals("Help"))
-		OnHelpCommand(sLine, ChanCmds);
-	else if (sCmd.Equals("List"))
-		OnListCommand(pChan, sLine, ChanVars);
-	else if (sCmd.Equals("Get"))
-		OnGetCommand(pChan, sLine, ChanVars);
-	else if (sCmd.Equals("Set"))
-		OnSetCommand(pChan, sLine, ChanVars);
-	else if (sCmd.Equals("Reset"))
-		OnResetCommand(pChan, sLine, ChanVars);
-	else
-		OnExecCommand(pChan, sLine, ChanCmds);
+	// sparklines are not aligned by the tables, which count bytes
+	size_t uWidth = 0;
+	for (const auto& it : m_Shared.history) {
+		if (it.first.find('/') == CString::npos)
+			uWidth = std::max(uWidth, it.first.size());
+	}
+	for (const auto& it : m_Shared.history) {
+		if (it.first.find('/') != CString::npos)
+			continue;
+		unsigned long long uMax, uSum;
+		const CString sSpark = GetSparkline(*it.second, HistoryTraffic, uMax, uSum);
+		CString sLine = it.first;
+		sLine.append(uWidth - it.first.size() + 1, ' ');
+		PutLine(sLine + sSpark + " " + CString::ToByteStr(uSum));
+	}
+}
 
-	return HALT;
+bool CAdminMod::CanAccessScope(const CString& sScope) const
+{
+	if (GetUser()->IsAdmin())
+		return true;
+	return sScope.Token(0, false, "/").Equals(GetUser()->GetUserName());
 }
 
-template <typename C>
-void CAdminMod::OnHelpCommand(const CString& sLine, const std::vector<C>& vCmds)
+void CAdminMod::GetConfigJSON(const VCString& vsScopes, const VCString& vsVars, CString& sJSON) const
 {
-	const CString sFilter = sLine.Token(1);
+	// {"scopes":[{"scope":"...","vars":{"<var>":"<value>",...}},...],"errors":[...]}
+	sJSON.reserve(64 * 1024);
+	sJSON = "{\"scopes\":[";
+	CString sCurrent;
+	bool bFirstScope = true, bFirstVar = true;
+	VCString vsErrors;
+
+	ConfigVisitor Writer = [&](const CString& sScope, const CString& sVar, const CString& sVal) {
+		if (sVar.Equals("@pass"))
+			return;
+		if (!vsVars.empty() && std::none_of(vsVars.begin(), vsVars.end(), [&](const CString& sPattern) {
+				return sVar.WildCmp(sPattern, CString::CaseInsensitive);
+			}))
+			return;
 
-	const CTable Table = FilterCmdTable(vCmds, sFilter);
-	if (!Table.empty())
-		PutTable(Table);
-	else
-		PutLine("No matches for '" + sFilter + "'");
+		if (bFirstScope || sScope != sCurrent) {
+			if (!bFirstScope)
+				sJSON += "}},";
+			sJSON += "{\"scope\":\"";
+			sJSON += EscapeJSON(sScope.empty() ? CString("-") : sScope);
+			sJSON += "\",\"vars\":{";
+			sCurrent = sScope;
+			bFirstScope = false;
+			bFirstVar = true;
+		}
+		if (!bFirstVar)
+			sJSON += ",";
+		sJSON += "\"";
+		sJSON += EscapeJSON(sVar);
+		sJSON += "\":\"";
+		sJSON += EscapeJSON(sVal);
+		sJSON += "\"";
+		bFirstVar = false;
+	};
+
+	for (const CString& sScope : vsScopes) {
+		const CString sReal = sScope == "-" ? CString() : sScope;
+		if (!CanAccessScope(sReal) || (sReal.empty() && !GetUser()->IsAdmin()))
+			vsErrors.push_back("access denied to '" + sScope + "'");
+		else if (!sReal.empty() && !HasScope(sReal))
+			vsErrors.push_back("unknown scope '" + sScope + "'");
+		else
+			CollectScope(sReal, Writer);
+	}
+
+	if (!bFirstScope)
+		sJSON += "}}";
+	sJSON += "],\"errors\":[";
+	for (size_t i = 0; i < vsErrors.size(); ++i)
+		sJSON += (i ? ",\"" : "\"") + EscapeJSON(vsErrors[i]) + "\"";
+	sJSON += "]}";
 }
 
-template <typename T, typename V>
-void CAdminMod::OnListCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars)
+void CAdminMod::SetConfigJSON(const VCString& vsValues, CString& sJSON)
 {
-	const CString sFilter = sLine.Token(1);
+	// {"results":[{"scope":"...","var":"...","ok":true,"error":"..."},...],
+	//  "saved":true,"error":"..."}, where saved tells whether the changes
+	// were written to the config file
+	sJSON = "{\"results\":[";
+	bool bChanged = false;
+	for (size_t i = 0; i < vsValues.size(); ++i) {
+		const CString sScope = vsValues[i].Token(0) == "-" ? CString() : vsValues[i].Token(0);
+		const CString sVar = vsValues[i].Token(1);
+		const CString sVal = vsValues[i].Token(2, true);
+
+		CString sError;
+		ApplyResult eResult = ApplyFailed;
+		if (sVar.empty())
+			sError = "expected <scope> <variable> <value>";
+		else if (!CanAccessScope(sScope) || ((sScope.empty() || sVar.StartsWith("@")) && !GetUser()->IsAdmin()))
+			sError = "access denied";
+		else {
+			const CString sOld = GetConfigValue(sScope, sVar);
+			eResult = ApplyConfig(sScope, sVar, sVal, false, sError);
+			if (eResult == ApplyChanged) {
+				Audit(AuditSet, sScope, sVar, sOld, GetConfigValue(sScope, sVar));
+				JournalValue(sScope, sVar, sOld);
+				bChanged = true;
+			}
+		}
 
-	const CTable Table = FilterVarTable(vVars, sFilter);
-	if (!Table.empty())
-		PutTable(Table);
-	else
-		PutError("unknown variable");
+		if (i > 0)
+			sJSON += ",";
+		sJSON += "{\"scope\":\"" + EscapeJSON(vsValues[i].Token(0)) + "\",\"var\":\"" + EscapeJSON(sVar)
+			+ "\",\"ok\":" + (eResult == ApplyFailed ? "false" : "true") + ",\"error\":\"" + EscapeJSON(sError) + "\"}";
+	}
+	sJSON += "]";
+
+	CommitUndo("web: " + CString(vsValues.size()) + " values");
+
+	CString sError;
+	if (bChanged && !CZNC::Get().WriteConfig())
+		sError = "failed to write '" + CZNC::Get().GetConfigFile() + "'";
+	sJSON += ",\"saved\":" + CString(bChanged && sError.empty() ? "true" : "false") + ",\"error\":\"" + EscapeJSON(sError) + "\"}";
 }
 
-template <typename T, typename V>
-void CAdminMod::OnGetCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars)
+bool CAdminMod::OpenControl(CString& sError)
 {
-	const CString sVar = sLine.Token(1);
+	if (m_pControl)
+		return true;
+
+	const CString sPath = GetSavePath() + "/control.sock";
+	sockaddr_un Addr;
+	memset(&Addr, 0, sizeof(Addr));
+	Addr.sun_family = AF_UNIX;
+	if (sPath.size() >= sizeof(Addr.sun_path)) {
+		sError = "path too long '" + sPath + "'";
+		return false;
+	}
+	memcpy(Addr.sun_path, sPath.c_str(), sPath.size());
 
-	if (sVar.empty()) {
-		PutUsage("Get <variable>");
-		return;
+	const int iFD = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (iFD < 0) {
+		sError = strerror(errno);
+		return false;
 	}
 
-	bool bFound = false;
-	for (const auto& Var : vVars) {
-		if (Var.name.WildCmp(sVar, CString::CaseInsensitive)) {
-			VCString vsValues;
-			Var.get(pObject).Split("\n", vsValues, false);
-			if (vsValues.empty()) {
-				PutLine(Var.name + " = ");
-			} else {
-				for (const CString& s : vsValues)
-					PutLine(Var.name + " = " + s);
-			}
-			bFound = true;
+	// access is governed by the file permissions of the socket
+	unlink(sPath.c_str());
+	const mode_t uMask = umask(0077);
+	const bool bBound = bind(iFD, reinterpret_cast<sockaddr*>(&Addr), sizeof(Addr)) == 0;
+	umask(uMask);
+
+	if (!bBound || listen(iFD, SOMAXCONN) != 0) {
+		sError = "unable to listen on '" + sPath + "': " + strerror(errno);
+		close(iFD);
+		return false;
+	}
+	fcntl(iFD, F_SETFL, fcntl(iFD, F_GETFL) | O_NONBLOCK);
+	fcntl(iFD, F_SETFD, FD_CLOEXEC);
+
+	m_pControl = new CAdminControl(iFD, [this](const CString& sLine) {
+		return OnControlLine(sLine);
+	});
+	CZNC::Get().GetManager().MonitorFD(m_pControl);
+	return true;
+}
+
+void CAdminMod::CloseControl()
+{
+	if (!m_pControl)
+		return;
+	// the socket manager deletes disabled monitors
+	m_pControl->Close();
+	m_pControl = nullptr;
+	unlink((GetSavePath() + "/control.sock").c_str());
+}
+
+CString CAdminMod::OnControlLine(const CString& sLine)
+{
+	// <id> <*|target> <command> [args], where target is the same as
+	// in **target queries and * stands for global commands
+	const CString sId = sLine.Token(0);
+	const CString sTarget = sLine.Token(1);
+	const CString sCommand = sLine.Token(2, true);
+
+	ControlCapture Capture;
+	m_pCapture = &Capture;
+	try {
+		if (sCommand.empty()) {
+			PutUsage("<id> <*|target> <command> [args]");
+		} else if (sTarget == "*") {
+			OnModCommand(sCommand);
+		} else {
+			m_sTarget = GetInfix() + sTarget;
+			if (OnTargetCommand(sTarget, sCommand) == CONTINUE)
+				PutError("unknown target '" + sTarget + "'");
 		}
+	} catch (...) {
+		// Restart and Shutdown
+		m_pCapture = nullptr;
+		throw;
 	}
+	m_pCapture = nullptr;
 
-	if (!bFound)
-		PutError("unknown variable");
+	CString sReply = "{\"id\":\"" + EscapeJSON(sId) + "\",\"ok\":" + (Capture.error ? "false" : "true") + ",\"output\":[";
+	for (size_t i = 0; i < Capture.lines.size(); ++i) {
+		if (i > 0)
+			sReply += ",";
+		sReply += "\"" + EscapeJSON(Capture.lines[i]) + "\"";
+	}
+	sReply += "]}\n";
+	return sReply;
 }
 
-template <typename T, typename V>
-void CAdminMod::OnSetCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars)
+void CAdminMod::SetWatch(const CString& sScope, const CString& sItems)
 {
-	const CString sVar = sLine.Token(1);
-	const CString sVal = sLine.Token(2, true);
-
-	if (sVar.empty() || sVal.empty()) {
-		PutUsage("Set <variable> <value>");
+	if (sItems.empty()) {
+		m_mWatches.erase(sScope);
+		DelNV("watch:" + sScope);
+		if (m_mWatches.empty())
+			m_Shared.watchers.erase(this);
 		return;
 	}
 
-	bool bFound = false;
-	for (const auto& Var : vVars) {
-		if (Var.name.WildCmp(sVar, CString::CaseInsensitive)) {
-			if (Var.set(pObject, sVal)) {
-				VCString vsValues;
-				Var.get(pObject).Split("\n", vsValues, false);
-				if (vsValues.empty()) {
-					PutLine(Var.name + " = ");
+	WatchInfo& Watch = m_mWatches[sScope];
+	Watch = WatchInfo();
+	sItems.Split(",", Watch.items, false);
+	SetNV("watch:" + sScope, sItems);
+
+	CheckWatches(false);
+}
+
+void CAdminMod::NotifyWatches(const CString& sScope, const CString& sItem)
+{
+	for (CModule* pModule : m_Shared.watchers)
+		static_cast<CAdminMod*>(pModule)->QueueWatch(sScope.empty() ? "-" : sScope, sItem);
+}
+
+void CAdminMod::QueueWatch(const CString& sScope, const CString& sItem)
+{
+	for (auto& it : m_mWatches) {
+		WatchInfo& Watch = it.second;
+		if (Watch.primed && sScope.WildCmp(it.first, CString::CaseInsensitive) && MatchesAny(sItem, Watch.items))
+			Watch.queue.insert(sScope + "\t" + sItem);
+	}
+}
+
+void CAdminMod::CheckWatches(bool bRescan)
+{
+	// changes made through the admin module are pushed to the queue by
+	// NotifyWatches() and their values read once per tick, so repeated
+	// changes coalesce; the rescan of the watched names catches changes
+	// made elsewhere, e.g. by webadmin or by the IRC clients of users
+	// that do not have the admin module loaded
+	VCString vsLines;
+	auto fnReport = [&](const CString& sKey, const CString* pOld, const CString* pNew) {
+		if (!pOld || !pNew || *pOld != *pNew)
+			vsLines.push_back(FormatWatch(sKey, pOld, pNew));
+	};
+
+	for (auto& it : m_mWatches) {
+		WatchInfo& Watch = it.second;
+		std::map<CString, CString> mState;
+
+		if (!Watch.primed || bRescan) {
+			CollectWatch(it.first, Watch.items, mState);
+			if (Watch.primed) {
+				auto itOld = Watch.state.cbegin();
+				auto itNew = mState.cbegin();
+				while (itOld != Watch.state.cend() || itNew != mState.cend()) {
+					if (itNew == mState.cend() || (itOld != Watch.state.cend() && itOld->first < itNew->first)) {
+						fnReport(itOld->first, &itOld->second, nullptr);
+						++itOld;
+					} else if (itOld == Watch.state.cend() || itNew->first < itOld->first) {
+						fnReport(itNew->first, nullptr, &itNew->second);
+						++itNew;
+					} else {
+						fnReport(itNew->first, &itOld->second, &itNew->second);
+						++itOld;
+						++itNew;
+					}
+				}
+			}
+			Watch.state.swap(mState);
+			Watch.primed = true;
+		} else {
+			for (const CString& sKey : Watch.queue) {
+				const CString sScope = sKey.Token(0, false, "\t");
+				CollectWatch(sScope, VCString(1, sKey.Token(1, true, "\t")), mState);
+				auto itOld = Watch.state.find(sKey);
+				auto itNew = mState.find(sKey);
+				if (itNew == mState.end()) {
+					if (itOld != Watch.state.end()) {
+						fnReport(sKey, &itOld->second, nullptr);
+						Watch.state.erase(itOld);
+					}
+				} else if (itOld == Watch.state.end()) {
+					fnReport(sKey, nullptr, &itNew->second);
+					Watch.state[sKey] = itNew->second;
 				} else {
-					for (const CString& s : vsValues)
-						PutLine(Var.name + " = " + s);
+					fnReport(sKey, &itOld->second, &itNew->second);
+					itOld->second = itNew->second;
 				}
 			}
-			bFound = true;
 		}
+		Watch.queue.clear();
 	}
 
-	if (!bFound)
-		PutError("unknown variable");
+	for (size_t i = 0; i < vsLines.size() && i < WatchLines; ++i)
+		PutLine(vsLines[i], GetModName());
+	if (vsLines.size() > WatchLines)
+		PutLine("... and " + CString(vsLines.size() - WatchLines) + " more changes", GetModName());
+
+	if (m_mWatches.empty())
+		return;
+	m_Shared.watchers.insert(this);
+	if (!FindTimer("watch")) {
+		AddTimer(new CAdminTimer(this, WatchInterval, "watch", [this]() {
+			CheckWatches(++m_uWatchTicks % (WatchRescan / WatchInterval) == 0);
+			return !m_mWatches.empty();
+		}));
+	}
 }
 
-template <typename T, typename V>
-void CAdminMod::OnResetCommand(T* pObject, const CString& sLine, const std::vector<V>& vVars)
+void CAdminMod::CollectWatch(const CString& sScope, const VCString& vsItems, std::map<CString, CString>& mState) const
 {
-	const CString sVar = sLine.Token(1);
+	// only the values of the watched names are read, not whole configs
+	bool bVars = false;
+	for (const CString& sItem : vsItems)
+		bVars |= !sItem.StartsWith("@");
+
+	auto fnCollect = [&](const CString& sVarScope, const CString& sItem, const std::function<CString()>& fnGet) {
+		if (MatchesAny(sItem, vsItems))
+			mState[sVarScope + "\t" + sItem] = fnGet();
+	};
 
-	if (sVar.empty()) {
-		PutUsage("Reset <variable>");
+	if (sScope == "-") {
+		CZNC& ZNC = CZNC::Get();
+		if (bVars)
+			CollectWatchVars(&ZNC, "-", GlobalVars, vsItems, mState);
+		fnCollect("-", "@ports", [&]() {
+			VCString vsPorts;
+			for (const CListener* pListener : ZNC.GetListeners())
+				vsPorts.push_back(GetListenerString(pListener));
+			return CString("\n").Join(vsPorts.begin(), vsPorts.end());
+		});
+		fnCollect("-", "@modules", [&]() { return GetModulesString(ZNC.GetModules()); });
 		return;
 	}
 
-	bool bFound = false;
-	for (const auto& Var : vVars) {
-		if (Var.name.WildCmp(sVar, CString::CaseInsensitive)) {
-			if (!Var.reset) {
-				PutError("reset not supported");
-			} else if (Var.reset(pObject)) {
-				VCString vsValues;
-				Var.get(pObject).Split("\n", vsValues, false);
-				if (vsValues.empty()) {
-					PutLine(Var.name + " = ");
-				} else {
-					for (const CString& s : vsValues)
-						PutLine(Var.name + " = " + s);
-				}
-			}
-			bFound = true;
+	// only users whose name matches can contribute
+	const CString sUserPattern = sScope.Token(0, false, "/");
+	std::vector<const CUser*> vUsers;
+	if (sUserPattern.find_first_of("*?") == CString::npos) {
+		if (const CUser* pUser = CZNC::Get().FindUser(sUserPattern))
+			vUsers.push_back(pUser);
+	} else {
+		for (const auto& it : CZNC::Get().GetUserMap()) {
+			if (it.first.WildCmp(sUserPattern, CString::CaseInsensitive))
+				vUsers.push_back(it.second);
 		}
 	}
 
-	if (!bFound)
-		PutError("unknown variable");
+	for (const CUser* pUser : vUsers) {
+		const CString sUser = pUser->GetUserName();
+		if (sUser.WildCmp(sScope, CString::CaseInsensitive)) {
+			if (bVars)
+				CollectWatchVars(pUser, sUser, UserVars, vsItems, mState);
+			fnCollect(sUser, "@pass", [&]() { return GetPassString(pUser); });
+			fnCollect(sUser, "@modules", [&]() { return GetModulesString(pUser->GetModules()); });
+			fnCollect(sUser, "@user", []() { return CString(); });
+			fnCollect(sUser, "@client", [&]() { return CString(pUser->GetAllClients().size()); });
+		}
+
+		for (const CIRCNetwork* pNetwork : pUser->GetNetworks()) {
+			const CString sNetwork = sUser + "/" + pNetwork->GetName();
+			if (sNetwork.WildCmp(sScope, CString::CaseInsensitive)) {
+				if (bVars)
+					CollectWatchVars(pNetwork, sNetwork, NetworkVars, vsItems, mState);
+				fnCollect(sNetwork, "@servers", [&]() {
+					VCString vsServers;
+					for (const CServer* pServer : pNetwork->GetServers())
+						vsServers.push_back(pServer->GetString());
+					return CString("\n").Join(vsServers.begin(), vsServers.end());
+				});
+				fnCollect(sNetwork, "@modules", [&]() { return GetModulesString(pNetwork->GetModules()); });
+				fnCollect(sNetwork, "@network", [&]() { return CString(pNetwork->IsIRCConnected()); });
+				fnCollect(sNetwork, "@client", [&]() { return CString(pNetwork->GetClients().size()); });
+			}
+
+			if (!bVars)
+				continue;
+			for (const CChan* pChan : pNetwork->GetChans()) {
+				const CString sChan = sNetwork + "/" + pChan->GetName();
+				if (sChan.WildCmp(sScope, CString::CaseInsensitive))
+					CollectWatchVars(pChan, sChan, ChanVars, vsItems, mState);
+			}
+		}
+	}
 }
 
-template <typename T, typename C>
-void CAdminMod::OnExecCommand(T* pObject, const CString& sLine, const std::vector<C>& vCmds)
+template <typename T, typename V>
+void CAdminMod::CollectWatchVars(const T* pObject, const CString& sScope, const std::vector<V>& vVars, const VCString& vsItems, std::map<CString, CString>& mState) const
 {
-	const CString sCmd = sLine.Token(0);
-	const CString sArgs = sLine.Token(1, true);
+	for (const auto& Var : vVars) {
+		// the same exclusions as CollectVars()
+		if (Var.name.Equals("Password") || Var.name.Equals("AdminInfix"))
+			continue;
+		if (MatchesAny(Var.name, vsItems))
+			mState[sScope + "\t" + Var.name] = Var.get(pObject);
+	}
+}
 
-	for (const auto& Cmd : vCmds) {
-		if (Cmd.syntax.Token(0).Equals(sCmd)) {
-			Cmd.exec(pObject, sArgs);
-			return;
-		}
+CString CAdminMod::FormatWatch(const CString& sKey, const CString* pOld, const CString* pNew)
+{
+	const CString sScope = sKey.Token(0, false, "\t");
+	const CString sItem = sKey.Token(1, true, "\t");
+
+	if (sItem == "@user")
+		return "user " + sScope + (pNew ? " added" : " deleted");
+	if (sItem == "@network") {
+		if (!pOld || !pNew)
+			return "network " + sScope + (pNew ? " added" : " deleted");
+		return sScope + (pNew->ToBool() ? " connected" : " disconnected");
+	}
+	if (sItem == "@client") {
+		const unsigned int uOld = pOld ? pOld->ToUInt() : 0;
+		const unsigned int uNew = pNew ? pNew->ToUInt() : 0;
+		return sScope + ": client " + (uNew > uOld ? "attached" : "detached") + " (" + CString(uNew) + " clients)";
 	}
 
-	PutError("unknown command");
+	if (!pNew)
+		return sScope + ": " + sItem + " removed";
+	CString sLine = sScope + ": " + sItem + " = " + pNew->Replace_n("\n", ", ");
+	if (pOld)
+		sLine += " (was " + pOld->Replace_n("\n", ", ") + ")";
+	return sLine;
 }
 
-template <typename T>
-void CAdminMod::OnListModsCommand(T* pObject, const CString& sArgs, CModInfo::EModuleType eType)
+CString CAdminMod::GetBufferKey(const CIRCNetwork* pNetwork, const CString& sName)
 {
-	const CString sFilter = sArgs.Token(0);
+	return pNetwork->GetUser()->GetUserName() + "/" + pNetwork->GetName() + "/" + sName;
+}
 
-	std::set<CModInfo> sMods;
-	pObject->GetModules().GetAvailableMods(sMods, eType);
+CAdminMod* CAdminMod::FindOtherAdmin() const
+{
+	for (const auto& it : CZNC::Get().GetUserMap()) {
+		if (!it.second->IsAdmin())
+			continue;
+		CAdminMod* pMod = dynamic_cast<CAdminMod*>(it.second->GetModules().FindModule(GetModName()));
+		if (pMod && pMod != this)
+			return pMod;
+	}
+	return nullptr;
+}
 
-	CTable Table;
-	Table.AddColumn("Module");
-	Table.AddColumn("Description");
+void CAdminMod::SaveBuffers()
+{
+	// <magic> { <type> <key> <size> <count> { <sec> <usec> <format> <text> <tags> }... }...
+	const CString sFile = CZNC::Get().GetZNCPath() + "/admin.buffers";
+	CFile File(sFile + ".tmp");
+	if (!File.Open(O_WRONLY | O_CREAT | O_TRUNC, 0600)) {
+		PutError("failed to write '" + sFile + "'");
+		return;
+	}
 
-	for (const CModInfo& Info : sMods) {
-		const CString& sName = Info.GetName();
-		if (sFilter.empty() || sName.StartsWith(sFilter) || sName.WildCmp(sFilter, CString::CaseInsensitive)) {
-			Table.AddRow();
-			if (pObject->GetModules().FindModule(sName))
-				Table.SetCell("Module", sName + " (loaded)");
-			else
-				Table.SetCell("Module", sName);
-			Table.SetCell("Description", Info.GetDescription().Ellipsize(128));
+	timeval tvStart, tvEnd;
+	gettimeofday(&tvStart, nullptr);
+
+	CString sOut(BufferMagic, sizeof(BufferMagic));
+	unsigned long long uLines = 0, uBytes = 0;
+	unsigned int uBuffers = 0;
+	bool bOk = true;
+
+	auto fnAppend = [&](BufferType eType, const CString& sKey, const CBuffer& Buffer) {
+		if (Buffer.IsEmpty())
+			return;
+		CString sRecord;
+		for (size_t i = 0; i < Buffer.Size(); ++i) {
+			const CBufLine& Line = Buffer.GetBufLine(i);
+			CString sTags;
+			for (const auto& it : Line.GetTags())
+				sTags += it.first.Escape_n(CString::EURL) + "=" + it.second.Escape_n(CString::EURL) + "&";
+			const timeval tv = Line.GetTime();
+			AppendBinary(sRecord, int64_t(tv.tv_sec));
+			AppendBinary(sRecord, int32_t(tv.tv_usec));
+			AppendBinary(sRecord, Line.GetFormat());
+			AppendBinary(sRecord, Line.GetText());
+			AppendBinary(sRecord, sTags);
+		}
+		AppendBinary(sOut, uint8_t(eType));
+		AppendBinary(sOut, sKey);
+		AppendBinary(sOut, uint64_t(sRecord.size() + sizeof(uint32_t)));
+		AppendBinary(sOut, uint32_t(Buffer.Size()));
+		sOut.append(sRecord);
+		uLines += Buffer.Size();
+		++uBuffers;
+
+		// flush in chunks to keep the peak memory bounded
+		if (sOut.size() >= 1024 * 1024) {
+			bOk &= File.Write(sOut) == (ssize_t) sOut.size();
+			uBytes += sOut.size();
+			sOut.clear();
+		}
+	};
+
+	for (const auto& it : CZNC::Get().GetUserMap()) {
+		for (const CIRCNetwork* pNetwork : it.second->GetNetworks()) {
+			for (const CChan* pChan : pNetwork->GetChans())
+				fnAppend(ChanBuffer, GetBufferKey(pNetwork, pChan->GetName()), pChan->GetBuffer());
+			for (const CQuery* pQuery : pNetwork->GetQueries())
+				fnAppend(QueryBuffer, GetBufferKey(pNetwork, pQuery->GetName()), pQuery->GetBuffer());
 		}
 	}
 
-	if (Table.empty())
-		PutError("no matches for '" + sFilter + "'");
-	else
-		PutTable(Table);
+	bOk &= File.Write(sOut) == (ssize_t) sOut.size();
+	uBytes += sOut.size();
+	bOk &= File.Sync();
+	File.Close();
+
+	if (!bOk || !CFile::Move(sFile + ".tmp", sFile, true)) {
+		CFile::Delete(sFile + ".tmp");
+		PutError("failed to write '" + sFile + "'");
+		return;
+	}
+
+	gettimeofday(&tvEnd, nullptr);
+	const double dMs = (tvEnd.tv_sec - tvStart.tv_sec) * 1000.0 + (tvEnd.tv_usec - tvStart.tv_usec) / 1000.0;
+	const CString sSummary = CString(uBuffers) + " buffers, " + CString(uLines) + " lines, "
+		+ CString(uBytes / (1024.0 * 1024.0), 1) + " MB in " + CString(dMs, 1) + " ms ("
+		+ (dMs > 0 ? CString(uBytes / (1024.0 * 1024.0) / (dMs / 1000.0), 1) : CString("-")) + " MB/s)";
+	SetSharedNV("buffers:saved", sSummary);
+	DEBUG("admin: saved " << sSummary);
+	PutSuccess("saved " + sSummary);
 }
 
-template <typename T>
-void CAdminMod::OnLoadModCommand(T* pObject, const CString& sArgs, CModInfo::EModuleType eType)
+void CAdminMod::LoadBuffers()
 {
-	if (!GetUser()->IsAdmin() && GetUser()->DenyLoadMod()) {
-		PutError("access deniend");
+	BufferFile& Buffers = m_Shared.buffers;
+	if (Buffers.data)
 		return;
-	}
 
-	const CString sMod = sArgs.Token(0);
-	if (sMod.empty()) {
-		PutUsage("LoadMod <module> [args]");
+	const CString sFile = CZNC::Get().GetZNCPath() + "/admin.buffers";
+	const int iFD = open(sFile.c_str(), O_RDONLY);
+	if (iFD < 0)
+		return;
+
+	struct stat st;
+	void* pData = MAP_FAILED;
+	if (fstat(iFD, &st) == 0 && st.st_size >= (off_t) sizeof(BufferMagic))
+		pData = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, iFD, 0);
+	close(iFD);
+
+	if (pData == MAP_FAILED || memcmp(pData, BufferMagic, sizeof(BufferMagic)) != 0) {
+		if (pData != MAP_FAILED)
+			munmap(pData, st.st_size);
+		DEBUG("admin: ignoring invalid buffer file '" << sFile << "'");
+		CFile::Delete(sFile);
 		return;
 	}
+	madvise(pData, st.st_size, MADV_SEQUENTIAL);
+
+	// the file stays until all its buffers are restored, an admin loaded
+	// meanwhile finds them mapped and does not restore them again
+	Buffers.owner = this;
+	Buffers.data = static_cast<const char*>(pData);
+	Buffers.size = st.st_size;
+	Buffers.inode = st.st_ino;
+
+	// index the records by their key, the lines are only parsed on restore
+	CBufferReader Reader(Buffers.data, Buffers.size, sizeof(BufferMagic));
+	uint8_t uType;
+	CString sKey;
+	uint64_t uSize;
+	while (true) {
+		const size_t uOffset = Reader.Pos() - Buffers.data;
+		if (!Reader.Read(uType) || !Reader.Read(sKey) || !Reader.Read(uSize) || !Reader.Skip(uSize))
+			break;
+		// a later record of the same buffer wins
+		Buffers.offsets[sKey.AsLower()] = uOffset;
+	}
 
-	CModInfo Info;
-	CString sError;
-	if (!pObject->GetModules().GetModInfo(Info, sMod, sError))
-		PutError(sError);
-	else if (!pObject->GetModules().LoadModule(sMod, sArgs.Token(1, true), eType, nullptr, nullptr, sError))
-		PutError(sError);
-	else
-		PutSuccess("module '" + sMod + "' loaded");
+	// restore what has been loaded so far, the rest follows in OnBoot()
+	// before any client is accepted, or in the background if the module
+	// is loaded at runtime
+	RestoreBuffers(false);
+	if (Buffers.data)
+		TakeBuffers();
 }
 
-template <typename T>
-void CAdminMod::OnReloadModCommand(T* pObject, const CString& sArgs)
+void CAdminMod::UnloadBuffers()
 {
-	if (!GetUser()->IsAdmin() && GetUser()->DenyLoadMod()) {
-		PutError("access deniend");
+	BufferFile& Buffers = m_Shared.buffers;
+	if (Buffers.data)
+		munmap(const_cast<char*>(Buffers.data), Buffers.size);
+	Buffers = BufferFile();
+}
+
+void CAdminMod::TakeBuffers()
+{
+	m_Shared.buffers.owner = this;
+	AddTimer(new CAdminTimer(this, 1, "buffers", [this]() {
+		RestoreBuffers(true, BatchSize);
+		return m_Shared.buffers.data != nullptr;
+	}));
+}
+
+void CAdminMod::RestoreBuffers(bool bAll, unsigned int uMax)
+{
+	BufferFile& Buffers = m_Shared.buffers;
+	if (!Buffers.data)
 		return;
+
+	timeval tvStart, tvEnd;
+	gettimeofday(&tvStart, nullptr);
+
+	for (auto it = Buffers.offsets.begin(); it != Buffers.offsets.end() && uMax > 0; --uMax) {
+		if (RestoreBuffer(it->second, bAll))
+			it = Buffers.offsets.erase(it);
+		else
+			++it;
 	}
 
-	const CString sMod = sArgs.Token(0);
-	if (sMod.empty()) {
-		PutUsage("ReloadMod <module> [args]");
-		return;
+	gettimeofday(&tvEnd, nullptr);
+	Buffers.ms += (tvEnd.tv_sec - tvStart.tv_sec) * 1000.0 + (tvEnd.tv_usec - tvStart.tv_usec) / 1000.0;
+
+	if (Buffers.offsets.empty()) {
+		const CString sSummary = CString(Buffers.lines) + " lines, "
+			+ CString(Buffers.bytes / (1024.0 * 1024.0), 1) + " MB in " + CString(Buffers.ms, 1) + " ms ("
+			+ (Buffers.ms > 0 ? CString(Buffers.bytes / (1024.0 * 1024.0) / (Buffers.ms / 1000.0), 1) : CString("-")) + " MB/s)";
+		SetSharedNV("buffers:restored", sSummary);
+		DEBUG("admin: restored " << sSummary);
+
+		const CString sFile = CZNC::Get().GetZNCPath() + "/admin.buffers";
+		struct stat st;
+		if (stat(sFile.c_str(), &st) == 0 && st.st_ino == Buffers.inode)
+			CFile::Delete(sFile);
+		if (Buffers.owner)
+			static_cast<CAdminMod*>(Buffers.owner)->UnloadBuffers();
 	}
+}
 
-	CModInfo Info;
-	CString sError;
-	if (!pObject->GetModules().GetModInfo(Info, sMod, sError))
-		PutError(sError);
-	else if (!pObject->GetModules().ReloadModule(sMod, sArgs.Token(1, true), nullptr, nullptr, sError))
-		PutError(sError);
-	else
-		PutSuccess("module '" + sMod + "' reloaded");
+bool CAdminMod::RestoreBuffer(size_t uOffset, bool bAll)
+{
+	BufferFile& Buffers = m_Shared.buffers;
+	CBufferReader Reader(Buffers.data, Buffers.size, uOffset);
+
+	uint8_t uType;
+	CString sKey;
+	uint64_t uSize;
+	uint32_t uCount;
+	if (!Reader.Read(uType) || !Reader.Read(sKey) || !Reader.Read(uSize) || !Reader.Read(uCount))
+		return true;
+
+	// the key keeps the original case of the user, network and query names
+	CUser* pUser = CZNC::Get().FindUser(sKey.Token(0, false, "/"));
+	CIRCNetwork* pNetwork = pUser ? pUser->FindNetwork(sKey.Token(1, false, "/")) : nullptr;
+	const CString sName = sKey.Token(2, true, "/");
+	if (!pNetwork)
+		return bAll;
+
+	bool bRestored = false;
+	if (uType == ChanBuffer) {
+		// channels that are not in the config are gone after a restart
+		CChan* pChan = pNetwork->FindChan(sName);
+		if (!pChan)
+			return bAll;
+		RestoreLines(pChan, Reader, uCount);
+		bRestored = true;
+	} else if (uType == QueryBuffer) {
+		CQuery* pQuery = pNetwork->FindQuery(sName);
+		if (!pQuery)
+			pQuery = pNetwork->AddQuery(sName);
+		if (pQuery) {
+			RestoreLines(pQuery, Reader, uCount);
+			bRestored = true;
+		}
+	}
+	if (bRestored) {
+		Buffers.lines += uCount;
+		Buffers.bytes += uSize;
+	}
+	return true;
 }
 
 template <typename T>
-void CAdminMod::OnUnloadModCommand(T* pObject, const CString& sArgs)
+void CAdminMod::RestoreLines(T* pTarget, CBufferReader& Reader, uint32_t uCount)
 {
-	if (!GetUser()->IsAdmin() && GetUser()->DenyLoadMod()) {
-		PutError("access deniend");
-		return;
+	// lines received since startup go after the restored ones
+	const CBuffer& Buffer = pTarget->GetBuffer();
+	std::vector<CBufLine> vNewer;
+	vNewer.reserve(Buffer.Size());
+	for (size_t i = 0; i < Buffer.Size(); ++i)
+		vNewer.push_back(Buffer.GetBufLine(i));
+	pTarget->ClearBuffer();
+
+	int64_t iSec;
+	int32_t iUsec;
+	CString sFormat, sText, sTags;
+	for (uint32_t i = 0; i < uCount; ++i) {
+		if (!Reader.Read(iSec) || !Reader.Read(iUsec) || !Reader.Read(sFormat) || !Reader.Read(sText) || !Reader.Read(sTags))
+			break;
+		MCString mssTags;
+		VCString vsTags;
+		sTags.Split("&", vsTags, false);
+		for (const CString& sTag : vsTags)
+			mssTags[sTag.Token(0, false, "=").Escape_n(CString::EURL, CString::EASCII)] = sTag.Token(1, true, "=").Escape_n(CString::EURL, CString::EASCII);
+		timeval tv;
+		tv.tv_sec = iSec;
+		tv.tv_usec = iUsec;
+		pTarget->AddBuffer(sFormat, sText, &tv, mssTags);
 	}
 
-	const CString sMod = sArgs.Token(0);
-	if (sMod.empty()) {
-		PutUsage("UnloadMod <module> [args]");
+	for (const CBufLine& Line : vNewer) {
+		const timeval tv = Line.GetTime();
+		pTarget->AddBuffer(Line.GetFormat(), Line.GetText(), &tv, Line.GetTags());
+	}
+}
+
+void CAdminMod::SearchBuffers(const std::vector<std::pair<CString, const CBuffer*>>& vBuffers, const CString& sArgs)
+{
+	CString sPattern = sArgs.Token(0);
+	size_t uLimit = 50;
+	if (sArgs.Token(1).Equals("--limit")) {
+		uLimit = std::min(sArgs.Token(2).ToUInt(), 500u);
+	} else if (sArgs.Token(0).Equals("--limit")) {
+		uLimit = std::min(sArgs.Token(1).ToUInt(), 500u);
+		sPattern = sArgs.Token(2);
+	}
+
+	if (sPattern.empty() || !uLimit) {
+		PutUsage("Search <pattern> [--limit <n>]");
 		return;
 	}
 
-	CModInfo Info;
-	CString sError;
-	if (!pObject->GetModules().GetModInfo(Info, sMod, sError))
-		PutError(sError);
-	else if (!pObject->GetModules().UnloadModule(sMod, sError))
-		PutError(sError);
-	else
-		PutSuccess("module '" + sMod + "' unloaded");
+	// plain patterns are case sensitive substrings, found with a memchr()
+	// driven std::string::find(), wildcards match the whole text
+	const bool bWild = sPattern.find_first_of("*?") != CString::npos;
+	const CString sTimezone = GetUser()->GetTimezone();
+
+	size_t uFound = 0;
+	size_t uLines = 0;
+	for (const auto& it : vBuffers) {
+		const CBuffer& Buffer = *it.second;
+		for (size_t i = 0; i < Buffer.Size(); ++i) {
+			const CBufLine& Line = Buffer.GetBufLine(i);
+			const CString& sText = Line.GetText();
+			++uLines;
+			if (bWild ? !sText.WildCmp(sPattern, CString::CaseInsensitive) : sText.find(sPattern) == CString::npos)
+				continue;
+
+			if (++uFound > uLimit)
+				break;
+			PutLine(it.first + " " + CUtils::FormatTime(Line.GetTime().tv_sec, "[%Y-%m-%d %H:%M:%S]", sTimezone) + " " + sText);
+		}
+		if (uFound > uLimit)
+			break;
+	}
+
+	if (!uFound)
+		PutLine("No matches for '" + sPattern + "' in " + CString(uLines) + " lines");
+	else if (uFound > uLimit)
+		PutLine("More than " + CString(uLimit) + " matches, use --limit to see more");
 }
 
-template <typename C>
-CTable CAdminMod::FilterCmdTable(const std::vector<C>& vCmds, const CString& sFilter) const
+void CAdminMod::AddNetworkBuffers(const CIRCNetwork* pNetwork, const CString& sPrefix, std::vector<std::pair<CString, const CBuffer*>>& vBuffers)
 {
-	std::map<CString, CString> mCommands;
+	for (const CChan* pChan : pNetwork->GetChans())
+		vBuffers.push_back(std::make_pair(sPrefix + pChan->GetName(), &pChan->GetBuffer()));
+	for (const CQuery* pQuery : pNetwork->GetQueries())
+		vBuffers.push_back(std::make_pair(sPrefix + pQuery->GetName(), &pQuery->GetBuffer()));
+}
 
-	if (sFilter.empty() || CString("Get").WildCmp(sFilter, CString::CaseInsensitive))
-		mCommands["Get <variable>"] = "Gets the value of a variable.";
-	if (sFilter.empty() || CString("Help").WildCmp(sFilter, CString::CaseInsensitive))
-		mCommands["Help [filter]"] = "Generates this output.";
-	if (sFilter.empty() || CString("List").WildCmp(sFilter, CString::CaseInsensitive))
-		mCommands["List [filter]"] = "Lists available variables filtered by name or type.";
-	if (sFilter.empty() || CString("Reset").WildCmp(sFilter, CString::CaseInsensitive))
-		mCommands["Reset <variable>"] = "Resets the value of a variable.";
-	if (sFilter.empty() || CString("Set").WildCmp(sFilter, CString::CaseInsensitive))
-		mCommands["Set <variable> <value>"] = "Sets the value of a variable.";
+void CAdminMod::RunBatches(const CString& sLabel, const std::function<bool()>& fnBatch)
+{
+	// the first batch runs right away, the rest once per second
+	// so that large operations do not block the event loop
+	if (fnBatch())
+		AddTimer(new CAdminTimer(this, 1, sLabel, fnBatch));
+}
 
-	for (const auto& Cmd : vCmds) {
-		const CString sCmd =  Cmd.syntax.Token(0);
-		if (sFilter.empty() || sCmd.StartsWith(sFilter) || sCmd.WildCmp(sFilter, CString::CaseInsensitive))
-			mCommands[Cmd.syntax] = Cmd.description;
+const MCString& CAdminMod::GetSharedRegistry()
+{
+	SharedState& Shared = GetShared();
+	if (!Shared.loaded) {
+		Shared.loaded = true;
+		Shared.registry.ReadFromDisk(CZNC::Get().GetZNCPath() + "/admin.registry");
 	}
+	return Shared.registry;
+}
 
-	CTable Table;
-	Table.AddColumn("Command");
-	Table.AddColumn("Description");
+CString CAdminMod::GetSharedNV(const CString& sKey)
+{
+	const MCString& msRegistry = GetSharedRegistry();
+	auto it = msRegistry.find(sKey);
+	return it != msRegistry.end() ? it->second : "";
+}
 
-	for (const auto& it : mCommands) {
-		Table.AddRow();
-		Table.SetCell("Command", it.first);
-		Table.SetCell("Description", it.second);
+void CAdminMod::SetSharedNV(const CString& sKey, const CString& sValue, bool bWriteToDisk)
+{
+	GetSharedRegistry();
+	GetShared().registry[sKey] = sValue;
+	if (bWriteToDisk)
+		SaveSharedNV();
+}
+
+void CAdminMod::DelSharedNV(const CString& sKey, bool bWriteToDisk)
+{
+	GetSharedRegistry();
+	GetShared().registry.erase(sKey);
+	if (bWriteToDisk)
+		SaveSharedNV();
+}
+
+void CAdminMod::SaveSharedNV()
+{
+	const CString sPath = CZNC::Get().GetZNCPath() + "/admin.registry";
+	if (GetShared().registry.WriteToDisk(sPath, 0600) != MCString::MCS_SUCCESS)
+		DEBUG("admin: failed to write '" << sPath << "'");
+}
+
+CString CAdminMod::GetFilePath(const CString& sFile) const
+{
+	// plain file names are relative to the module data directory,
+	// admins may also use absolute paths
+	if (sFile.StartsWith("/") && GetUser()->IsAdmin())
+		return sFile;
+	return CDir::CheckPathPrefix(GetSavePath(), sFile, GetSavePath());
+}
+
+CListener* CAdminMod::ParseListener(const CString& sArgs) const
+{
+	CString sPort = sArgs.Token(0);
+	CString sAddr = sArgs.Token(1);
+	CString sAccept = sArgs.Token(2);
+	CString sBindHost = sArgs.Token(3);
+	CString sURIPrefix = sArgs.Token(4);
+
+	unsigned short uPort = sPort.ToUShort();
+	bool bSSL = sPort.StartsWith("+");
+
+	if (sBindHost == "*")
+		sBindHost.clear();
+
+	EAddrType eAddr = ADDR_ALL;
+	if (sAddr.Equals("IPV4"))
+		eAddr = ADDR_IPV4ONLY;
+	else if (sAddr.Equals("IPV6"))
+		eAddr = ADDR_IPV6ONLY;
+	else if (sAddr.Equals("ALL"))
+		eAddr = ADDR_ALL;
+	else
+		sAddr.clear();
+
+	CListener::EAcceptType eAccept = CListener::ACCEPT_ALL;
+	if (sAccept.Equals("WEB"))
+		eAccept = CListener::ACCEPT_HTTP;
+	else if (sAccept.Equals("IRC"))
+		eAccept = CListener::ACCEPT_IRC;
+	else if (sAccept.Equals("ALL"))
+		eAccept = CListener::ACCEPT_ALL;
+	else
+		sAccept.clear();
+
+	if (sPort.empty() || sAddr.empty() || sAccept.empty())
+		return nullptr;
+
+	return new CListener(uPort, sBindHost, sURIPrefix, bSSL, eAddr, eAccept);
+}
+
+CString CAdminMod::GetListenerString(const CListener* pListener)
+{
+	CString sPort = (pListener->IsSSL() ? "+" : "") + CString(pListener->GetPort());
+
+	switch (pListener->GetAddrType()) {
+	case ADDR_IPV4ONLY:
+		sPort += " ipv4";
+		break;
+	case ADDR_IPV6ONLY:
+		sPort += " ipv6";
+		break;
+	default:
+		sPort += " all";
+		break;
 	}
 
-	return Table;
+	switch (pListener->GetAcceptType()) {
+	case CListener::ACCEPT_HTTP:
+		sPort += " web";
+		break;
+	case CListener::ACCEPT_IRC:
+		sPort += " irc";
+		break;
+	default:
+		sPort += " all";
+		break;
+	}
+
+	if (!pListener->GetBindHost().empty() || !pListener->GetURIPrefix().empty())
+		sPort += " " + (pListener->GetBindHost().empty() ? CString("*") : pListener->GetBindHost());
+	if (!pListener->GetURIPrefix().empty())
+		sPort += " " + pListener->GetURIPrefix();
+
+	return sPort;
 }
 
-template <typename V>
-CTable CAdminMod::FilterVarTable(const std::vector<V>& vVars, const CString& sFilter) const
+CString CAdminMod::GetModulesString(const CModules& Modules)
 {
-	CTable Table;
-	Table.AddColumn("Variable");
-	Table.AddColumn("Description");
+	VCString vsModules;
+	for (const CModule* pModule : Modules)
+		vsModules.push_back((pModule->GetModName() + " " + pModule->GetArgs()).TrimRight_n());
+	return CString("\n").Join(vsModules.begin(), vsModules.end());
+}
 
-	for (const auto& Var : vVars) {
-		CString sType(VarTypes[Var.type]);
-		if (sFilter.empty() || sType.Equals(sFilter) || Var.name.StartsWith(sFilter) || Var.name.WildCmp(sFilter, CString::CaseInsensitive)) {
-			Table.AddRow();
-			Table.SetCell("Variable", Var.name + " (" + sType + ")");
-			Table.SetCell("Description", Var.description);
-		}
+CString CAdminMod::GetPassString(const CUser* pUser)
+{
+	// the same <method>#<hash>#<salt># format as in znc.conf
+	CString sMethod;
+	switch (pUser->GetPassHashType()) {
+	case CUser::HASH_NONE:
+		sMethod = "plain";
+		break;
+	case CUser::HASH_MD5:
+		sMethod = "md5";
+		break;
+	case CUser::HASH_SHA256:
+		sMethod = "sha256";
+		break;
 	}
+	return sMethod + "#" + pUser->GetPass() + "#" + pUser->GetPassSalt() + "#";
+}
 
-	return Table;
+bool CAdminMod::SetPassString(CUser* pUser, const CString& sPass)
+{
+	const CString sMethod = sPass.Token(0, false, "#");
+	const CString sHash = sPass.Token(1, false, "#");
+	const CString sSalt = sPass.Token(2, false, "#");
+
+	if (sHash.empty())
+		return false;
+
+	if (sMethod.Equals("plain"))
+		pUser->SetPass(sHash, CUser::HASH_NONE, sSalt);
+	else if (sMethod.Equals("md5"))
+		pUser->SetPass(sHash, CUser::HASH_MD5, sSalt);
+	else if (sMethod.Equals("sha256"))
+		pUser->SetPass(sHash, CUser::HASH_SHA256, sSalt);
+	else
+		return false;
+
+	return true;
 }
 
 void CAdminMod::PutSuccess(const CString& sLine, const CString& sTarget)
 {
-	PutLine("Success: " + sLine, sTarget);
+	m_sScratch.assign("Success: ").append(sLine);
+	PutLine(m_sScratch, sTarget);
 }
 
 void CAdminMod::PutUsage(const CString& sSyntax, const CString& sTarget)
 {
-	PutLine("Usage: " + sSyntax, sTarget);
+	if (m_pCapture)
+		m_pCapture->error = true;
+	++m_uErrors;
+	m_sScratch.assign("Usage: ").append(sSyntax);
+	PutLine(m_sScratch, sTarget);
 }
 
 void CAdminMod::PutError(const CString& sError, const CString& sTarget)
 {
-	PutLine("Error: " + sError, sTarget);
+	if (m_pCapture)
+		m_pCapture->error = true;
+	++m_uErrors;
+	m_sScratch.assign("Error: ").append(sError);
+	PutLine(m_sScratch, sTarget);
 }
 
 void CAdminMod::PutLine(const CString& sLine, const CString& sTarget)
 {
-	const CString sTgt = sTarget.empty() ? (m_sTarget.empty() ? GetModName() : m_sTarget) : sTarget;
+	if (m_pCapture) {
+		m_pCapture->lines.push_back(sLine);
+		return;
+	}
+
+	// no copy of the target for every line
+	const CString& sTgt = !sTarget.empty() ? sTarget : (!m_sTarget.empty() ? m_sTarget : GetModName());
 
 	if (CClient* pClient = GetClient())
 		pClient->PutModule(sTgt, sLine);
@@ -2468,12 +8132,32 @@ void CAdminMod::PutLine(const CString& sLine, const CString& sTarget)
 		pUser->PutModule(sTgt, sLine);
 }
 
-void CAdminMod::PutTable(const CTable& Table, const CString& sTarget)
+unsigned int CAdminMod::PutModule(const CString& sLine)
 {
-	CString sLine;
-	unsigned int i = 0;
-	while (Table.GetLine(i++, sLine))
-		PutLine(sLine, sTarget);
+	if (m_pCapture) {
+		m_pCapture->lines.push_back(sLine);
+		return 1;
+	}
+	return CModule::PutModule(sLine);
+}
+
+void CAdminMod::PutTable(const CAdminTable& Table, const CString& sTarget)
+{
+	if (Table.empty())
+		return;
+
+	// captured output keeps a line per row, clients get the whole table
+	// rendered into the scratch buffer as one message, which ZNC splits
+	// at the newlines
+	if (m_pCapture) {
+		CString sLine;
+		size_t i = 0;
+		while (Table.GetLine(i++, sLine))
+			PutLine(sLine, sTarget);
+		return;
+	}
+	Table.Render(m_sScratch);
+	PutLine(m_sScratch, sTarget);
 }
 
 template<> void TModInfo<CAdminMod>(CModInfo& Info) {
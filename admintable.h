@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2015 J-P Nurmi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ADMINTABLE_H
+#define ADMINTABLE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+// a table with cells addressed by column index and stored in a string
+// arena shared by the tables of a command, rendered as the same grid as
+// CTable; a cell can only be appended to right after it was set, and
+// tables sharing an arena are built one after another
+//
+// the string type is a parameter so that the table can be tested
+// without ZNC, the module uses it with CString
+template <typename S>
+class TAdminTable
+{
+public:
+	TAdminTable(S& sArena, std::initializer_list<const char*> lColumns) : m_sArena(sArena)
+	{
+		AddColumns(lColumns.begin(), lColumns.end());
+	}
+
+	// columns known only at runtime, the names must outlive the table
+	TAdminTable(S& sArena, const std::vector<const char*>& vColumns) : m_sArena(sArena)
+	{
+		AddColumns(vColumns.begin(), vColumns.end());
+	}
+
+	// empties an arena after a command, and releases it if a large
+	// table made it grow beyond what is worth keeping
+	static void ResetArena(S& sArena, size_t uKeep)
+	{
+		if (sArena.capacity() > uKeep)
+			S().swap(sArena);
+		else
+			sArena.clear();
+	}
+
+	void Reserve(size_t uRows, size_t uBytesPerRow)
+	{
+		m_vCells.reserve(uRows * m_vHeaders.size());
+		m_sArena.reserve(m_sArena.size() + uRows * uBytesPerRow);
+	}
+
+	void AddRow() { m_vCells.resize(m_vCells.size() + m_vHeaders.size()); }
+
+	void SetCell(size_t uColumn, const char* szValue, size_t uLen)
+	{
+		Cell& C = m_vCells[m_vCells.size() - m_vHeaders.size() + uColumn];
+		C.offset = m_sArena.size();
+		C.length = 0;
+		AppendCell(uColumn, szValue, uLen);
+	}
+	void SetCell(size_t uColumn, const S& sValue) { SetCell(uColumn, sValue.data(), sValue.size()); }
+	void SetCell(size_t uColumn, const char* szValue) { SetCell(uColumn, szValue, strlen(szValue)); }
+
+	void AppendCell(size_t uColumn, const char* szValue, size_t uLen)
+	{
+		Cell& C = m_vCells[m_vCells.size() - m_vHeaders.size() + uColumn];
+		m_sArena.append(szValue, uLen);
+		C.length += uLen;
+		m_vWidths[uColumn] = std::max<size_t>(m_vWidths[uColumn], C.length);
+	}
+	void AppendCell(size_t uColumn, const S& sValue) { AppendCell(uColumn, sValue.data(), sValue.size()); }
+	void AppendCell(size_t uColumn, const char* szValue) { AppendCell(uColumn, szValue, strlen(szValue)); }
+
+	bool empty() const { return m_vCells.empty(); }
+	size_t size() const { return m_vCells.size() / m_vHeaders.size(); }
+
+	// renders a border, the header or a row into sLine, reusing its capacity
+	bool GetLine(size_t uIdx, S& sLine) const
+	{
+		sLine.clear();
+		return AppendLine(uIdx, sLine);
+	}
+
+	// renders all lines separated by newlines into sOut, reusing its capacity
+	void Render(S& sOut) const
+	{
+		sOut.clear();
+		size_t uWidth = 1;
+		for (size_t uColumnWidth : m_vWidths)
+			uWidth += uColumnWidth + 3;
+		sOut.reserve((size() + 4) * (uWidth + 1));
+		for (size_t i = 0; AppendLine(i, sOut); ++i)
+			sOut += '\n';
+		if (!sOut.empty())
+			sOut.resize(sOut.size() - 1);
+	}
+
+private:
+	template <typename It>
+	void AddColumns(It itBegin, It itEnd)
+	{
+		m_vHeaders.reserve(itEnd - itBegin);
+		m_vWidths.reserve(itEnd - itBegin);
+		for (It it = itBegin; it != itEnd; ++it) {
+			m_vHeaders.push_back(*it);
+			m_vWidths.push_back(strlen(*it));
+		}
+	}
+
+	bool AppendLine(size_t uIdx, S& sLine) const
+	{
+		const size_t uRows = size();
+		if (uRows == 0 || uIdx > uRows + 3)
+			return false;
+
+		if (uIdx == 0 || uIdx == 2 || uIdx == uRows + 3) {
+			for (size_t uWidth : m_vWidths) {
+				sLine += '+';
+				sLine.append(uWidth + 2, '-');
+			}
+			sLine += '+';
+			return true;
+		}
+
+		for (size_t i = 0; i < m_vHeaders.size(); ++i) {
+			const char* szValue = m_vHeaders[i];
+			size_t uLen = strlen(szValue);
+			if (uIdx > 2) {
+				const Cell& C = m_vCells[(uIdx - 3) * m_vHeaders.size() + i];
+				szValue = m_sArena.data() + C.offset;
+				uLen = C.length;
+			}
+			sLine += "| ";
+			sLine.append(szValue, uLen);
+			sLine.append(m_vWidths[i] - uLen + 1, ' ');
+		}
+		sLine += '|';
+		return true;
+	}
+
+	struct Cell
+	{
+		uint32_t offset = 0;
+		uint32_t length = 0;
+	};
+
+	S& m_sArena;
+	std::vector<const char*> m_vHeaders;
+	std::vector<size_t> m_vWidths;
+	std::vector<Cell> m_vCells;
+};
+
+#endif // ADMINTABLE_H
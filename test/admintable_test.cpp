@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2015 J-P Nurmi
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// checks that building and rendering a table allocates a constant number
+// of times regardless of its rows, like ListChans of a network with 2000
+// channels; standalone, without ZNC:
+//
+//   c++ -std=c++11 -O2 -o admintable_test test/admintable_test.cpp && ./admintable_test
+
+#include "../admintable.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+static size_t g_uAllocs = 0;
+
+void* operator new(size_t uSize)
+{
+	++g_uAllocs;
+	if (void* p = malloc(uSize ? uSize : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+typedef TAdminTable<std::string> CAdminTable;
+
+static const size_t ArenaKeep = 64 * 1024;
+
+// a ListChans of uRows channels, rendered into sOut
+static void ListChans(std::string& sArena, const std::vector<std::string>& vChans, size_t uRows, std::string& sOut)
+{
+	CAdminTable::ResetArena(sArena, ArenaKeep);
+	CAdminTable Table(sArena, { "Channel", "Status" });
+	Table.Reserve(uRows, 32);
+	for (size_t i = 0; i < uRows; ++i) {
+		Table.AddRow();
+		Table.SetCell(0, "", 0);
+		if (i % 3 == 0)
+			Table.AppendCell(0, "@", 1);
+		Table.AppendCell(0, vChans[i]);
+		Table.SetCell(1, i % 2 ? "Joined" : "Detached");
+	}
+	Table.Render(sOut);
+}
+
+static int Fail(const char* szWhat, size_t uExpected, size_t uActual)
+{
+	fprintf(stderr, "FAIL: %s: expected %zu, got %zu\n", szWhat, uExpected, uActual);
+	return 1;
+}
+
+int main()
+{
+	const size_t uRows = 2000;
+	std::vector<std::string> vChans;
+	for (size_t i = 0; i < uRows; ++i)
+		vChans.push_back("#channel-" + std::to_string(i));
+
+	std::string sArena, sOut;
+
+	// warm up the arena and the output buffer
+	ListChans(sArena, vChans, uRows, sOut);
+	if (sOut.compare(0, 2, "+-") != 0)
+		return Fail("rendered lines", 1, 0);
+	size_t uLines = 0;
+	for (char c : sOut)
+		uLines += c == '\n';
+	if (uLines + 1 != uRows + 4)
+		return Fail("rendered lines", uRows + 4, uLines + 1);
+
+	// with warm buffers only the per-table vectors are allocated: the
+	// headers, widths and cells
+	g_uAllocs = 0;
+	ListChans(sArena, vChans, 10, sOut);
+	const size_t uFew = g_uAllocs;
+
+	g_uAllocs = 0;
+	ListChans(sArena, vChans, uRows, sOut);
+	const size_t uMany = g_uAllocs;
+
+	if (uMany != uFew)
+		return Fail("allocations for 2000 rows vs 10 rows", uFew, uMany);
+	if (uMany > 3)
+		return Fail("allocations per table", 3, uMany);
+
+	// the arena is released after an oversized command
+	sArena.reserve(2 * ArenaKeep);
+	CAdminTable::ResetArena(sArena, ArenaKeep);
+	if (sArena.capacity() > ArenaKeep)
+		return Fail("arena capacity", ArenaKeep, sArena.capacity());
+
+	// columns known only at runtime render like the literal ones
+	const std::vector<const char*> vColumns = { "Channel", "Status" };
+	CAdminTable Runtime(sArena, vColumns);
+	Runtime.AddRow();
+	Runtime.SetCell(0, "#znc");
+	Runtime.SetCell(1, "Joined");
+	std::string sRuntime;
+	Runtime.Render(sRuntime);
+	const std::string sExpected =
+		"+---------+--------+\n"
+		"| Channel | Status |\n"
+		"+---------+--------+\n"
+		"| #znc    | Joined |\n"
+		"+---------+--------+";
+	if (sRuntime != sExpected)
+		return Fail("runtime column table length", sExpected.size(), sRuntime.size());
+
+	printf("OK: %zu allocations for %zu rows\n", uMany, uRows);
+	return 0;
+}